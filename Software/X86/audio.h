@@ -52,16 +52,24 @@ class Audio {
 		int right_n;
 		/** Center of this window */
 		int window_center;
+		/** Number of spectral bins reconstructed (n/2 unless band limited) */
+		int spectrum_limit;
+		/** IMDCT size: n, or n/2 or n/4 for reduced-rate output */
+		int synthesis_n;
 
 		/** Vector to keep track of which channels have no residue in this frame */
 		int *no_residue;
+		/** Vector to keep track of which channels have an unused floor (an all-zero spectrum) in this frame */
+		int *silent;
+		/** True when every channel in this frame is silent */
+		bool silent_frame;
 
-		/** The decoded floor data, in channel order */
+		/** The decoded floor data, in channel order (NULL for silent channels) */
 		double **floor_out;
 		/** The decoded residue data, associated with the correct channel */
 		double **residue_out;
 
-		/** The spectrum data */
+		/** The spectrum data (NULL for silent channels) */
 		int **spectrum;
 
 		/** Pointer to the mapping for this frame */
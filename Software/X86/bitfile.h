@@ -23,6 +23,11 @@
 
 #include <iostream>
 #include <cstdlib>
+#include <cstdio>
+#include <cstring>
+
+/** Bytes examined at a time when scanning for a pattern */
+#define BITFILE_SCAN_BLOCK 65536
 
 using namespace std;
 
@@ -39,23 +44,40 @@ class BitFile {
 		/** End of file? */
 		bool eof;
 		
+		/** Bytes read ahead of the current position by peek() */
+		unsigned char *lookahead;
+		/** Size of the lookahead buffer */
+		int lookahead_capacity;
+		/** Position of the next unread byte in lookahead */
+		int lookahead_pos;
+		/** End of the bytes held in lookahead */
+		int lookahead_end;
+		
 		/**
 		* Constructor to initialize the FileInputStream
-		* @param filename The name of the file to open and read
+		* @param filename The name of the file to open and read; if it can't
+		* be opened, infile is NULL and the stream starts out at eof
 		*/
 		BitFile(char *filename) {
 			infile = fopen(filename, "rb"); // Initialize
-				
-			if (!infile) {
-				cout << "Unable to open file!" << endl;
-				exit(1);
-			}
 			
-			eof = false;
+			eof = (infile == NULL);
 			
 			curbyte = -1;
 			bitpos = 0;
 			bytenum = 0;
+			
+			lookahead = NULL;
+			lookahead_capacity = 0;
+			lookahead_pos = 0;
+			lookahead_end = 0;
+		}
+		
+		/** Closes the file */
+		~BitFile() {
+			if (infile != NULL)
+				fclose(infile);
+			delete [] lookahead;
 		}
 		
 		/**
@@ -64,28 +86,158 @@ class BitFile {
 		* @return The actual number of bytes read in
 		*/
 		int readbytes(int *bytes, int len) {
-			unsigned char *b = new unsigned char[len];
+			if (infile == NULL)
+				return 0;
 			
 			int bytesread = 0;
 			
-			bytesread = fread(b, 1, len, infile);
-			
-			for (int i=0; i<bytesread; i++)
-				bytes[i] = b[i]&0xFF; // We only want 8 bits
+			// Anything peek() has read ahead comes first
+			while (bytesread < len && lookahead_pos < lookahead_end)
+				bytes[bytesread++] = lookahead[lookahead_pos++];
 			
 			if (bytesread < len) {
-				if (feof(infile)) {
-					eof = true;
-					exit(1);
+				unsigned char *b = new unsigned char[len - bytesread];
+				int n = fread(b, 1, len - bytesread, infile);
+				
+				for (int i=0; i<n; i++)
+					bytes[bytesread + i] = b[i]&0xFF; // We only want 8 bits
+				bytesread += n;
+				
+				if (bytesread < len) {
+					if (feof(infile))
+						eof = true;
 				}
+				
+				delete [] b;
 			}
 			
 			bytenum += bytesread;
 			
-			delete b;
-			
 			return bytesread;
 		}
+		
+		/**
+		* Steps over bytes without reading them in
+		* @param len The number of bytes to skip
+		*/
+		void skipbytes(int len) {
+			if (len <= 0)
+				return;
+			
+			int buffered = lookahead_end - lookahead_pos;
+			if (buffered > len)
+				buffered = len;
+			lookahead_pos += buffered;
+			bytenum += buffered;
+			len -= buffered;
+			if (len == 0)
+				return;
+			
+			if (fseek(infile, len, SEEK_CUR) == 0) {
+				bytenum += len;
+				return;
+			}
+			
+			// Not seekable (a pipe): read and discard
+			int *discard = new int[len];
+			readbytes(discard, len);
+			delete [] discard;
+		}
+		
+		/**
+		* Looks at upcoming bytes without moving past them
+		* @param data Set to the bytes at the current position
+		* @param len The number of bytes wanted
+		* @return The number of bytes available, less than len at the end of file
+		*/
+		int peek(unsigned char **data, int len) {
+			if (infile == NULL)
+				return 0;
+			
+			int buffered = lookahead_end - lookahead_pos;
+			if (buffered < len) {
+				if (lookahead_capacity < len) {
+					unsigned char *grown = new unsigned char[len];
+					if (buffered > 0) // Nothing is allocated before the first peek
+						memcpy(grown, lookahead + lookahead_pos, buffered);
+					delete [] lookahead;
+					lookahead = grown;
+					lookahead_capacity = len;
+				} else
+					memmove(lookahead, lookahead + lookahead_pos, buffered);
+				lookahead_pos = 0;
+				lookahead_end = buffered + fread(lookahead + buffered, 1, len - buffered, infile);
+				buffered = lookahead_end;
+			}
+			
+			*data = lookahead + lookahead_pos;
+			return (buffered < len ? buffered : len);
+		}
+		
+		/**
+		* Moves up to the next occurrence of a byte pattern, scanning a block
+		* at a time with memchr for its first byte
+		* @param pattern The bytes to look for
+		* @param len Length of the pattern
+		* @return True if found, false if the file ended first
+		*/
+		bool find(const char *pattern, int len) {
+			while (true) {
+				// Scan what's already read ahead, or read ahead another block
+				unsigned char *data;
+				int buffered = lookahead_end - lookahead_pos;
+				int n = peek(&data, buffered >= len ? buffered : BITFILE_SCAN_BLOCK);
+				if (n < len) {
+					skipbytes(n);
+					return false;
+				}
+				
+				unsigned char *p = data;
+				unsigned char *last = data + n - len; // Last place a match can start
+				while (p <= last && (p = (unsigned char *)memchr(p, pattern[0], last - p + 1)) != NULL) {
+					if (memcmp(p, pattern, len) == 0) {
+						skipbytes(p - data);
+						return true;
+					}
+					p++;
+				}
+				
+				// Keep the tail, which could start a match running into the next block
+				skipbytes(last - data + 1);
+			}
+		}
+		
+		/**
+		* Finds the size of the file
+		* @return The size in bytes, or -1 if it can't be found (a pipe)
+		*/
+		long length() {
+			if (infile == NULL)
+				return -1;
+			
+			long here = ftell(infile);
+			if (here < 0 || fseek(infile, 0, SEEK_END) != 0)
+				return -1;
+			long size = ftell(infile);
+			fseek(infile, here, SEEK_SET);
+			return size;
+		}
+		
+		/**
+		* Moves to a byte offset in the file
+		* @param offset The offset from the start of the file
+		* @return True on success; pipes can't seek
+		*/
+		bool seek(long offset) {
+			if (infile == NULL || fseek(infile, offset, SEEK_SET) != 0)
+				return false;
+			
+			lookahead_pos = 0;
+			lookahead_end = 0;
+			bytenum = offset;
+			eof = false;
+			return true;
+		}
 };
 
 #endif
@@ -0,0 +1,163 @@
+/***************************************************************************
+ *   Copyright (C) 2008 by Steve Heindel   *
+ *   stevenheindel@gmail.com   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef COUPLING_H
+#define COUPLING_H
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define COUPLING_AVX
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define COUPLING_SSE2
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define COUPLING_NEON
+#endif
+
+/*
+ * Inverse channel coupling without a branch per bin. Of the spec's four
+ * sign cases, A > 0 keeps M as the magnitude and A <= 0 keeps it as the
+ * angle; the other channel is M + A, with A negated when M > 0 and A > 0
+ * agree. So each bin is one sum and two selects, done with compare masks
+ * (not sign bits, so zeros and NaNs take the same side as the branches).
+ */
+
+/** One bin: new magnitude and angle from the coupled pair */
+static inline void couple_bin(double M, double A, double &new_M, double &new_A) {
+	double S = M + (((M > 0) == (A > 0)) ? -A : A);
+	new_M = (A > 0) ? M : S;
+	new_A = (A > 0) ? S : M;
+}
+
+/** Uncouples n bins of a magnitude/angle residue pair in place */
+static inline void couple_residues(double *M, double *A, int n) {
+	int j = 0;
+#if defined(COUPLING_AVX)
+	const __m256d zero = _mm256_setzero_pd();
+	const __m256d sign = _mm256_set1_pd(-0.0);
+	for (; j+4<=n; j+=4) {
+		__m256d m = _mm256_loadu_pd(M+j);
+		__m256d a = _mm256_loadu_pd(A+j);
+		__m256d mp = _mm256_cmp_pd(m, zero, _CMP_GT_OQ);
+		__m256d ap = _mm256_cmp_pd(a, zero, _CMP_GT_OQ);
+		__m256d s = _mm256_add_pd(m, _mm256_xor_pd(a, _mm256_andnot_pd(_mm256_xor_pd(mp, ap), sign)));
+		_mm256_storeu_pd(M+j, _mm256_blendv_pd(s, m, ap));
+		_mm256_storeu_pd(A+j, _mm256_blendv_pd(m, s, ap));
+	}
+#elif defined(COUPLING_SSE2)
+	const __m128d zero = _mm_setzero_pd();
+	const __m128d sign = _mm_set1_pd(-0.0);
+	for (; j+2<=n; j+=2) {
+		__m128d m = _mm_loadu_pd(M+j);
+		__m128d a = _mm_loadu_pd(A+j);
+		__m128d mp = _mm_cmpgt_pd(m, zero);
+		__m128d ap = _mm_cmpgt_pd(a, zero);
+		__m128d s = _mm_add_pd(m, _mm_xor_pd(a, _mm_andnot_pd(_mm_xor_pd(mp, ap), sign)));
+		_mm_storeu_pd(M+j, _mm_or_pd(_mm_and_pd(ap, m), _mm_andnot_pd(ap, s)));
+		_mm_storeu_pd(A+j, _mm_or_pd(_mm_and_pd(ap, s), _mm_andnot_pd(ap, m)));
+	}
+#elif defined(COUPLING_NEON)
+	const float64x2_t zero = vdupq_n_f64(0);
+	const uint64x2_t sign = vdupq_n_u64(0x8000000000000000ULL);
+	for (; j+2<=n; j+=2) {
+		float64x2_t m = vld1q_f64(M+j);
+		float64x2_t a = vld1q_f64(A+j);
+		uint64x2_t mp = vcgtq_f64(m, zero);
+		uint64x2_t ap = vcgtq_f64(a, zero);
+		uint64x2_t flip = vbicq_u64(sign, veorq_u64(mp, ap));
+		float64x2_t s = vaddq_f64(m, vreinterpretq_f64_u64(veorq_u64(vreinterpretq_u64_f64(a), flip)));
+		vst1q_f64(M+j, vbslq_f64(ap, m, s));
+		vst1q_f64(A+j, vbslq_f64(ap, s, m));
+	}
+#endif
+	for (; j<n; j++)
+		couple_bin(M[j], A[j], M[j], A[j]);
+}
+
+/**
+ * couple_residues fused with the floor * residue dot product, for a pair
+ * whose residues nothing else needs: writes the two channels' spectra,
+ * (int)(floor * residue * scale), and leaves the residues as they were
+ */
+static inline void couple_spectra(const double *M, const double *A, const double *floor_M, const double *floor_A,
+		double scale, int *spectrum_M, int *spectrum_A, int n) {
+	int j = 0;
+#if defined(COUPLING_AVX)
+	const __m256d zero = _mm256_setzero_pd();
+	const __m256d sign = _mm256_set1_pd(-0.0);
+	const __m256d k = _mm256_set1_pd(scale);
+	for (; j+4<=n; j+=4) {
+		__m256d m = _mm256_loadu_pd(M+j);
+		__m256d a = _mm256_loadu_pd(A+j);
+		__m256d mp = _mm256_cmp_pd(m, zero, _CMP_GT_OQ);
+		__m256d ap = _mm256_cmp_pd(a, zero, _CMP_GT_OQ);
+		__m256d s = _mm256_add_pd(m, _mm256_xor_pd(a, _mm256_andnot_pd(_mm256_xor_pd(mp, ap), sign)));
+		__m256d new_m = _mm256_blendv_pd(s, m, ap);
+		__m256d new_a = _mm256_blendv_pd(m, s, ap);
+		_mm_storeu_si128((__m128i *)(spectrum_M+j),
+			_mm256_cvttpd_epi32(_mm256_mul_pd(_mm256_mul_pd(_mm256_loadu_pd(floor_M+j), new_m), k)));
+		_mm_storeu_si128((__m128i *)(spectrum_A+j),
+			_mm256_cvttpd_epi32(_mm256_mul_pd(_mm256_mul_pd(_mm256_loadu_pd(floor_A+j), new_a), k)));
+	}
+#elif defined(COUPLING_SSE2)
+	const __m128d zero = _mm_setzero_pd();
+	const __m128d sign = _mm_set1_pd(-0.0);
+	const __m128d k = _mm_set1_pd(scale);
+	for (; j+2<=n; j+=2) {
+		__m128d m = _mm_loadu_pd(M+j);
+		__m128d a = _mm_loadu_pd(A+j);
+		__m128d mp = _mm_cmpgt_pd(m, zero);
+		__m128d ap = _mm_cmpgt_pd(a, zero);
+		__m128d s = _mm_add_pd(m, _mm_xor_pd(a, _mm_andnot_pd(_mm_xor_pd(mp, ap), sign)));
+		__m128d new_m = _mm_or_pd(_mm_and_pd(ap, m), _mm_andnot_pd(ap, s));
+		__m128d new_a = _mm_or_pd(_mm_and_pd(ap, s), _mm_andnot_pd(ap, m));
+		_mm_storel_epi64((__m128i *)(spectrum_M+j),
+			_mm_cvttpd_epi32(_mm_mul_pd(_mm_mul_pd(_mm_loadu_pd(floor_M+j), new_m), k)));
+		_mm_storel_epi64((__m128i *)(spectrum_A+j),
+			_mm_cvttpd_epi32(_mm_mul_pd(_mm_mul_pd(_mm_loadu_pd(floor_A+j), new_a), k)));
+	}
+#elif defined(COUPLING_NEON)
+	const float64x2_t zero = vdupq_n_f64(0);
+	const uint64x2_t sign = vdupq_n_u64(0x8000000000000000ULL);
+	const float64x2_t k = vdupq_n_f64(scale);
+	for (; j+2<=n; j+=2) {
+		float64x2_t m = vld1q_f64(M+j);
+		float64x2_t a = vld1q_f64(A+j);
+		uint64x2_t mp = vcgtq_f64(m, zero);
+		uint64x2_t ap = vcgtq_f64(a, zero);
+		uint64x2_t flip = vbicq_u64(sign, veorq_u64(mp, ap));
+		float64x2_t s = vaddq_f64(m, vreinterpretq_f64_u64(veorq_u64(vreinterpretq_u64_f64(a), flip)));
+		float64x2_t new_m = vbslq_f64(ap, m, s);
+		float64x2_t new_a = vbslq_f64(ap, s, m);
+		// Saturating, as the scalar conversion is on this target
+		vst1_s32(spectrum_M+j, vqmovn_s64(vcvtq_s64_f64(vmulq_f64(vmulq_f64(vld1q_f64(floor_M+j), new_m), k))));
+		vst1_s32(spectrum_A+j, vqmovn_s64(vcvtq_s64_f64(vmulq_f64(vmulq_f64(vld1q_f64(floor_A+j), new_a), k))));
+	}
+#endif
+	for (; j<n; j++) {
+		double new_M, new_A;
+		couple_bin(M[j], A[j], new_M, new_A);
+		spectrum_M[j] = (int)(floor_M[j] * new_M * scale);
+		spectrum_A[j] = (int)(floor_A[j] * new_A * scale);
+	}
+}
+
+#endif
@@ -0,0 +1,50 @@
+/***************************************************************************
+ *   Copyright (C) 2008 by Steve Heindel   *
+ *   stevenheindel@gmail.com   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef DECODESTATS_H
+#define DECODESTATS_H
+
+// Build with VORBIS_STATS defined to count and time the decode in
+// OggVorbis::stats; without it the counters compile to nothing
+#ifdef VORBIS_STATS
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+static inline unsigned long long vorbis_cycles() { return __rdtsc(); }
+#elif defined(_M_IX86) || defined(_M_X64)
+#include <intrin.h>
+static inline unsigned long long vorbis_cycles() { return __rdtsc(); }
+#else
+#include <time.h>
+static inline unsigned long long vorbis_cycles() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+#define STATS_ADD(counter, n) (stats.counter += (n))
+#define STATS_START(t) unsigned long long t = vorbis_cycles()
+#define STATS_LAP(stage, t) do { unsigned long long lap = vorbis_cycles(); stats.stage_cycles[stage] += lap - t; t = lap; } while (0)
+#else
+#define STATS_ADD(counter, n)
+#define STATS_START(t)
+#define STATS_LAP(stage, t)
+#endif
+
+#endif
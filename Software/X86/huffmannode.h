@@ -38,6 +38,12 @@ class HuffmanNode {
 			rchild = NULL;
 			entry = setvalue;
 		}
+		
+		/** Frees the subtree below this node */
+		~HuffmanNode() {
+			delete lchild;
+			delete rchild;
+		}
 };
 
 #endif
@@ -36,6 +36,11 @@ class HuffmanTree {
 			root = new HuffmanNode(-1);
 		}
 		
+		/** Frees every node of the tree */
+		~HuffmanTree() {
+			delete root;
+		}
+		
 		/**
 		* Adds a new node to the tree in the first spot (left to right)
 		* available at a given tree depth
@@ -0,0 +1,380 @@
+/***************************************************************************
+ *   Copyright (C) 2008 by Steve Heindel   *
+ *   stevenheindel@gmail.com   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * The decoder's Ogg layer: finding, checking and reading pages, following
+ * the chain's logical streams, and assembling the packets on them.
+ */
+
+#include <iostream>
+#include <cstring>
+
+#include "vorbisdecoder.h"
+#include "decodestats.h"
+
+#include "CRC_lookup_table.h"
+
+using namespace std;
+
+void VorbisDecoder::find_length() {
+	long size = file->length();
+	if (size < 0)
+		return; // Can't seek in a pipe
+	
+	// A page is under 64 KB, so the file's last page is normally in the
+	// first block; the cap keeps a file with a long run of garbage at its
+	// end from being read whole
+	for (long block = 2*BITFILE_SCAN_BLOCK; block <= 32*BITFILE_SCAN_BLOCK; block *= 2) {
+		long start = (size > block ? size - block : 0);
+		if (!file->seek(start))
+			return;
+		
+		// The last good page in the block that finishes a packet (pages
+		// that don't carry a granule position of -1), of any stream
+		bool found = false;
+		int last_serial = 0;
+		long long last_granule = -1;
+		while (file->find("OggS", 4)) {
+			if (!page_at_cursor_valid()) {
+				file->skipbytes(1);
+				continue;
+			}
+			
+			unsigned char *header = NULL;
+			if (file->peek(&header, 27) < 27)
+				break;
+			int serial = header[14] | (header[15] << 8) | (header[16] << 16) | (header[17] << 24);
+			long long granule = 0;
+			for (int i=0; i<8; i++)
+				granule |= (long long)header[6 + i] << (i*8);
+			if (granule != -1) {
+				found = true;
+				last_serial = serial;
+				last_granule = granule;
+			}
+			
+			int length = 27 + header[26];
+			if (file->peek(&header, length) < length)
+				break;
+			for (int i=0; i<header[26]; i++)
+				length += header[27 + i];
+			file->skipbytes(length);
+		}
+		
+		// Only a file that ends with this stream gives its length: the
+		// last link of a chain says nothing about the first one's
+		if (found) {
+			if (last_serial == stream_serial)
+				length_samples = last_granule;
+			return;
+		}
+		if (start == 0)
+			return;
+	}
+}
+
+void VorbisDecoder::read_ogg_header() {
+	while (!read_ogg_page())
+		;
+}
+
+bool VorbisDecoder::read_ogg_page() {
+	int in[8];
+	
+	// Magic capture pattern "OggS"; if it isn't here, sync was lost
+	unsigned char *head;
+	if (file->peek(&head, 4) == 4 && memcmp(head, "OggS", 4) != 0) {
+		report(VORBIS_ERR_PAGE, "Magic capture pattern \"OggS\" not found; resyncing");
+		resync();
+	}
+	
+	// The Vorbis stream's pages, BOS pages, and pages of streams no BOS
+	// page announced (likely garbage) are checked whole before being
+	// read in: a corrupt page's segment table can't be trusted, so
+	// resync from just past its capture pattern instead. Pages of the
+	// other known streams are skipped unchecked
+	unsigned char *header;
+	if (file->peek(&header, 27) < 27)
+		file->skipbytes(27); // Too little left for a page: go to the end
+	else {
+		int serial = header[14] | (header[15] << 8) | (header[16] << 16) | (header[17] << 24);
+		bool check = (header[5] & 0x02) || (have_stream && serial == stream_serial) || !is_known_serial(serial);
+		if (check && !page_at_cursor_valid()) {
+			report(VORBIS_ERR_PAGE, "CRC checksum failed!");
+			file->skipbytes(1);
+			page.segments = 0;
+			return false;
+		}
+	}
+	
+	page.capture_pattern = 0;
+	file->readbytes(in, 4);
+	for (int i=0; i<4; i++)
+		page.capture_pattern |= ((in[i]&0xFF) << (i*8));
+	
+	if (file->eof) { // No more pages
+		page.segments = 0;
+		page.packet.segment_offset = 0;
+		page.packet.end_of_packet = true;
+		return true;
+	}
+	
+	// Version
+	file->readbytes(in, 1);
+	page.version = in[0];
+	
+	if (page.version != 0) {
+		report(VORBIS_ERR_PAGE, "Not Ogg version 0");
+		page.segments = 0;
+		return false;
+	}
+	
+	// Header type
+	file->readbytes(in, 1);
+	page.header_type = in[0];
+	
+	if (page.header_type < 0 || page.header_type > 7) {
+		report(VORBIS_ERR_PAGE, "Illegal header type");
+		page.segments = 0;
+		return false;
+	}
+	
+	// Granule position
+	page.granule_position = 0;
+	file->readbytes(in, 8);
+	for (int i=0; i<8; i++)
+		page.granule_position |= ((long long)(in[i]&0xFF) << (i*8));
+	
+	// Bitstream serial number
+	page.bitstream_serial_number = 0;
+	file->readbytes(in, 4);
+	for (int i=0; i<4; i++)
+		page.bitstream_serial_number |= ((in[i]&0xFF) << (i*8));
+	
+	// Page sequence number
+	page.sequence_number = 0;
+	file->readbytes(in, 4);
+	for (int i=0; i<4; i++)
+		page.sequence_number |= ((in[i]&0xFF) << (i*8));
+	
+	// CRC checksum
+	page.CRC_checksum = 0;
+	file->readbytes(in, 4);
+	for (int i=0; i<4; i++)
+		page.CRC_checksum |= ((in[i]&0xFF) << (i*8));
+	
+	// Page segments
+	file->readbytes(in, 1);
+	page.segments = in[0];
+	
+	// Segment table
+	delete [] page.segment_table; // This should probably be moved somewhere better...
+	page.segment_table = new int[page.segments];  // !5
+	file->readbytes(page.segment_table, page.segments);
+	
+	// Page data length
+	page.data_length = 0;
+	for (int i=0; i<page.segments; i++)
+		page.data_length += page.segment_table[i];
+	
+	// Demux: another stream's page is stepped over unread and unchecked.
+	// BOS pages are always read, since a new Vorbis stream may start
+	if (!(page.header_type & 0x02) && (!have_stream || page.bitstream_serial_number != stream_serial)) {
+		file->skipbytes(page.data_length);
+		page.segments = 0;
+		return false;
+	}
+	
+	// Page data
+	delete [] page.data; // This should probably be moved somewhere better...
+	page.data = new int[page.data_length];
+	file->readbytes(page.data, page.data_length);
+	
+	page.packet.data_offset = 0;
+	page.packet.segment_offset = 0;
+	
+	// Only the BOS pages of Vorbis streams that can follow the current
+	// one in a chain are of interest: those of its own group come before
+	// any of its other pages
+	if (page.header_type & 0x02) {
+		add_known_serial(page.bitstream_serial_number);
+		if (!is_vorbis_id_page() || (have_stream && !stream_ended && !stream_started)) {
+			page.segments = 0;
+			return false;
+		}
+	} else {
+		stream_started = true;
+		if (page.header_type & 0x04)
+			stream_ended = true;
+	}
+	STATS_ADD(pages, 1);
+	return true;
+}
+
+bool VorbisDecoder::is_known_serial(int serial) {
+	for (int i=0; i<known_serial_count; i++) {
+		if (known_serials[i] == serial)
+			return true;
+	}
+	return false;
+}
+
+void VorbisDecoder::add_known_serial(int serial) {
+	if (is_known_serial(serial))
+		return;
+	
+	if (known_serial_count == known_serial_capacity) {
+		known_serial_capacity = (known_serial_capacity == 0 ? 8 : known_serial_capacity*2);
+		int *grown = new int[known_serial_capacity];
+		for (int i=0; i<known_serial_count; i++)
+			grown[i] = known_serials[i];
+		delete [] known_serials;
+		known_serials = grown;
+	}
+	known_serials[known_serial_count++] = serial;
+}
+
+bool VorbisDecoder::resync() {
+	while (file->find("OggS", 4)) {
+		if (page_at_cursor_valid())
+			return true;
+		file->skipbytes(1);
+	}
+	return false;
+}
+
+bool VorbisDecoder::page_at_cursor_valid() {
+	unsigned char *data;
+	if (file->peek(&data, 27) < 27)
+		return false;
+	if (data[4] != 0 || data[5] > 7) // Version, header type
+		return false;
+	
+	int segments = data[26];
+	if (file->peek(&data, 27 + segments) < 27 + segments)
+		return false;
+	int length = 27 + segments;
+	for (int i=0; i<segments; i++)
+		length += data[27 + i];
+	if (file->peek(&data, length) < length)
+		return false;
+	
+	unsigned int CRC_checksum = data[22] | (data[23] << 8) | (data[24] << 16) | ((unsigned int)data[25] << 24);
+	unsigned int CRC_register = 0;
+	for (int i=0; i<length; i++) {
+		int byte = (i >= 22 && i < 26) ? 0 : data[i]; // The CRC field counts as zero
+		CRC_register = (CRC_register<<8) ^ CRC_lookup[((CRC_register >> 24)&0xFF) ^ byte];
+	}
+	STATS_ADD(crc_bytes, length);
+	return CRC_register == CRC_checksum;
+}
+
+bool VorbisDecoder::is_vorbis_id_page() {
+	static const char magic[7] = { 0x01, 'v', 'o', 'r', 'b', 'i', 's' };
+	if (page.data_length < 7)
+		return false;
+	for (int i=0; i<7; i++) {
+		if (page.data[i] != magic[i])
+			return false;
+	}
+	return true;
+}
+
+void VorbisDecoder::init_vorbis_packet() {
+	// If the last packet of the last page didn't span a page boundary,
+	// i.e. it ended exactly at the page's end, then we need a new page header
+	if (page.packet.segment_offset >= page.segments)
+		read_ogg_header();
+	
+	// A packet at the very start of a continued page is the tail of one
+	// that began on an earlier page
+	page.packet.continued = (page.packet.segment_offset == 0 && (page.header_type & 0x01));
+	
+	int len = 0;
+	bool end_of_packet = false;
+	int i;
+	// Get the length of the new packet
+	for (i=page.packet.segment_offset; i<page.segments && !end_of_packet; i++) {
+		len += page.segment_table[i];
+		if (page.segment_table[i] < 255)
+			end_of_packet = true;
+	}
+	page.packet.length = len;
+	page.packet.end_of_packet = end_of_packet; // Does this packet end on this page?
+	page.packet.segment_offset = i; // How far we've read in the segment table
+	
+	delete [] page.packet.data; // This should probably be moved somewhere better...
+	page.packet.data = new int[page.packet.length];
+	for (int j=0; j<page.packet.length; j++) // Copy over the data
+		page.packet.data[j] = page.data[j + page.packet.data_offset];
+	
+	page.packet.data_offset += page.packet.length; // Update the packet data offset
+	
+	page.packet.bytepos = 0; // Reset read byte position
+	page.packet.bitpos = 0; // Reset read bit position
+}
+
+bool VorbisDecoder::read_continuation_page() {
+	int sequence_number = page.sequence_number;
+	read_ogg_header();
+	if (file->eof)
+		return false;
+	
+	if (!(page.header_type & 0x01) || page.sequence_number != sequence_number + 1) {
+		fail(VORBIS_ERR_PACKET, "Page-spanning packet lost its continuation");
+		page.packet.end_of_packet = true;
+		return false;
+	}
+	
+	init_vorbis_packet();
+	return true;
+}
+
+void VorbisDecoder::assemble_packet() {
+	while (!page.packet.end_of_packet && !file->eof) {
+		int *head = page.packet.data;
+		int head_length = page.packet.length;
+		page.packet.data = NULL;
+		
+		if (!read_continuation_page()) {
+			page.packet.data = head;
+			page.packet.length = head_length;
+			break;
+		}
+		
+		int *whole = new int[head_length + page.packet.length];
+		for (int i=0; i<head_length; i++)
+			whole[i] = head[i];
+		for (int i=0; i<page.packet.length; i++)
+			whole[head_length + i] = page.packet.data[i];
+		delete [] head;
+		delete [] page.packet.data;
+		
+		page.packet.data = whole;
+		page.packet.length += head_length;
+	}
+}
+
+void VorbisDecoder::skip_packet() {
+	while (!page.packet.end_of_packet && !file->eof) {
+		if (!read_continuation_page())
+			break;
+	}
+}
@@ -18,1730 +18,2239 @@
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
  ***************************************************************************/
 
+/*
+ * Vorbis decode: headers, setup, floors, residue, the spectrum and PCM
+ * output. The Ogg framing the packets arrive in is read by ogg.cpp, and
+ * the inverse MDCT is in mdct.c.
+ */
+
 #include <iostream>
 #include <cstdlib>
+#include <cstring>
+#include <cmath>
 #include <stdio.h>
 
 #define PI 3.14159265
 
-#include "oggvorbis.h"
+// Decoded PCM is handed to the sink in blocks of this many long frames
+#define PCM_BLOCK_FRAMES 16
 
-#include "audio.h"
-#include "bitfile.h"
-#include "codebook.h"
-#include "floor1.h"
-#include "mapping.h"
-#include "mode.h"
-#include "packet.h"
-#include "residue.h"
+#include "vorbisdecoder.h"
+#include "decodestats.h"
+#include "coupling.h"
 
-#include "CRC_lookup_table.h"
 #include "floor1_inverse_dB_table.h"
 
 using namespace std;
 
-#include "mdct.h"
-#include "mdct.c"
+OggVorbis::OggVorbis(char *filename, decode_options *opts) {
+	decoder = new VorbisDecoder(filename, opts);
+}
+
+OggVorbis::~OggVorbis() {
+	delete decoder;
+}
+
+bool OggVorbis::headers_ok() {
+	return decoder->headers_ok;
+}
+
+vorbis_status OggVorbis::error() {
+	return decoder->error;
+}
+
+int OggVorbis::channels() {
+	return decoder->info.audio_channels;
+}
+
+int OggVorbis::sample_rate() {
+	return decoder->info.audio_sample_rate;
+}
+
+int OggVorbis::bitrate_maximum() {
+	return decoder->info.bitrate_maximum;
+}
+
+int OggVorbis::bitrate_nominal() {
+	return decoder->info.bitrate_nominal;
+}
+
+int OggVorbis::bitrate_minimum() {
+	return decoder->info.bitrate_minimum;
+}
+
+long long OggVorbis::length_samples() {
+	return decoder->length_samples;
+}
+
+const char *OggVorbis::vendor(int *length) {
+	*length = decoder->info.vendor_length;
+	return decoder->info.vendor_string;
+}
+
+int OggVorbis::comment_count() {
+	return decoder->info.user_comment_list_length;
+}
+
+const char *OggVorbis::user_comment(int index, int *length) {
+	*length = decoder->info.user_comment_length[index];
+	return decoder->info.user_comment[index];
+}
+
+const char *OggVorbis::comment(const char *name, int *length, int index) {
+	return decoder->comment(name, length, index);
+}
+
+const decode_stats *OggVorbis::stats() {
+#ifdef VORBIS_STATS
+	return &decoder->stats;
+#else
+	return NULL;
+#endif
+}
 
-class OggVorbis {
-public:
-	bool debug; // Set true to see debug info
-	bool warning; // Set true to see warnings
+VorbisDecoder::VorbisDecoder(char *filename, decode_options *opts) {
+	// Initializations
+	cout << hex;
 	
-	/** The file to read data from */
-	BitFile *file;
+	debug = false;
+	warning = false;
 	
-	/** Ogg page info */
-	ogg_page page;
+	options.bandlimit_hz = 0;
+	options.decimation = 1;
+	options.sink = NULL;
+	options.planar = false;
+	options.bits = 16;
+	options.dither = false;
+	options.downmix_channels = 0;
+	options.downmix_matrix = NULL;
+	options.downmix_matrix_channels = 0;
+	options.resample_rate = 0;
+	options.probe = false;
+	options.comment_limit = 0;
+	options.replaygain = REPLAYGAIN_OFF;
+	options.replaygain_preamp = 0;
+	if (opts)
+		options = *opts;
+	if (options.decimation != 2 && options.decimation != 4)
+		options.decimation = 1;
+	if (options.bits != 24 && options.bits != 32)
+		options.bits = 16;
+	pcm_bytes = (options.bits == 16 ? 2 : 4);
 	
-	/** Our header information: ID, comment, setup */
-	vorbis_info info;
+	page.segment_table = NULL;
+	page.data = NULL;
+	page.packet.data = NULL;
 	
-	/** Vorbis audio decode storage */
-	Audio audio;
-	/** Is *audio an unpreceded audio packet? */
-	bool first_packet;
+	page.segments = 0;
+	page.packet.segment_offset = 0;
 	
-	int **mdctright;
-	char *pcmout;
+	first_packet = true;
+	have_stream = false;
+	stream_ended = false;
+	stream_started = false;
+	known_serials = NULL;
+	known_serial_count = 0;
+	known_serial_capacity = 0;
+	headers_ok = false;
+	output_ready = false;
+	length_samples = -1;
+	spectrum_scale = 1.0 / 256;
+	limiting = false;
+	limit_gain = 65536;
 	
-	/**
-	 * Constructor which sets off the Ogg/Vorbis decoding process
-	 * @param infile The file to read from
-	 */
-	OggVorbis(char *filename) {
-		// Initializations
-		cout << hex;
-		
-		debug = false;
-		warning = false;
-		
-		page.segment_table = NULL;
-		page.data = NULL;
-		page.packet.data = NULL;
-		
-		first_packet = true;
-		
-		pcmout = new char[4096];
-		for (int i=0; i<4096; i++)
-			pcmout[i] = 0;
-		
-		file = new BitFile(filename);
-		
-		// Do something real
-		read_ogg_header();
-		
-		init_vorbis_packet();
-		read_vorbis_id_header();
-		
-		init_vorbis_packet();
-		read_vorbis_comment_header();
-		
+	status = VORBIS_OK;
+	error = VORBIS_OK;
+	
+	memset(&info, 0, sizeof(info));
+	setup_packet = NULL;
+#ifdef VORBIS_STATS
+	memset(&stats, 0, sizeof(stats));
+#endif
+	
+	sink = options.sink;
+	own_sink = (sink == NULL);
+	if (own_sink)
+		sink = new FilePCMSink();
+	
+	file = new BitFile(filename);
+	if (file->infile == NULL)
+		report(VORBIS_ERR_OPEN, "Unable to open file!");
+
+
+	// Writes a wav header (for testing)
+	/*
+	unsigned int wave_magic[11] = { 0x46464952, 0x00056424, 0x45564157, 0x20746d66, 0x00000010, 0x00010001, 0x0000ac44, 0x00015888, 0x00100002, 0x61746164, 0x00056400 };
+	for (int i=0; i<11; i++) {
+		fwrite(&(wave_magic[i]), 4, 1, stdout);
+	}
+	*/
+	
+	// Do something real: each stream of a chain starts with a BOS page
+	// holding its ID header
+	while (!file->eof) {
+		status = VORBIS_OK;
 		init_vorbis_packet();
-		read_vorbis_setup_header();
-		
-		mdctright = new int*[info.audio_channels];
-		for (int i=0; i<info.audio_channels; i++) {
-			mdctright[i] = new int[info.blocksize_1/4];
+		if (file->eof)
+			break;
+		if (page.header_type & 0x02) {
+			start_stream();
+			if (options.probe) {
+				if (headers_ok)
+					find_length();
+				break;
+			}
+		} else if (!headers_ok || page.packet.continued)
+			skip_packet(); // Nothing to decode it with, or its start was lost
+		else
+			decode_audio();
+	}
+	close_output();
+	
+	// Cleanup
+	if (own_sink)
+		delete sink;
+	sink = NULL;
+}
+
+VorbisDecoder::~VorbisDecoder() {
+	free_comments();
+	free_setup();
+	delete [] setup_packet;
+	delete [] known_serials;
+	delete [] page.segment_table;
+	delete [] page.data;
+	delete [] page.packet.data;
+	delete file;
+}
+
+void VorbisDecoder::report(vorbis_status code, const char *message) {
+	if (warning) cout << "Error: " << message << endl;
+	if (error == VORBIS_OK)
+		error = code;
+}
+
+void VorbisDecoder::fail(vorbis_status code, const char *message) {
+	report(code, message);
+	if (status == VORBIS_OK)
+		status = code;
+}
+
+void VorbisDecoder::read_vorbis_headers() {
+	stream_serial = page.bitstream_serial_number;
+	have_stream = true;
+	stream_ended = false;
+	stream_started = false;
+	
+	read_vorbis_id_header();
+	if (status != VORBIS_OK)
+		return;
+	
+	init_vorbis_packet();
+	read_vorbis_comment_header();
+	if (status != VORBIS_OK || options.probe)
+		return;
+	
+	init_vorbis_packet();
+	read_vorbis_setup_header();
+}
+
+void VorbisDecoder::start_stream() {
+	int last_channels = info.audio_channels;
+	int last_rate = info.audio_sample_rate;
+	int last_blocksize_1 = info.blocksize_1;
+	
+	free_comments();
+	read_vorbis_headers();
+	if (status != VORBIS_OK) {
+		// The stream can't be decoded without its headers: drop its
+		// pages until another one begins
+		have_stream = false;
+		headers_ok = false;
+		close_output();
+		return;
+	}
+	headers_ok = true;
+	if (debug) cout << "New stream, serial " << stream_serial << endl;
+	if (options.probe)
+		return;
+	
+	double gain = replaygain();
+	spectrum_scale = gain / 256;
+	limiting = (gain > 1);
+	limit_gain = 65536;
+	
+	if (!output_ready) {
+		build_downmix();
+		init_output();
+	} else if (info.audio_channels != last_channels || info.audio_sample_rate != last_rate || info.blocksize_1 != last_blocksize_1) {
+		// The output layout changes: finish off what was decoded so far
+		close_output();
+		build_downmix();
+		init_output();
+	} else {
+		// Same layout: keep the output going, but the new stream
+		// doesn't overlap the old one, and may have a new short blocksize
+		for (int i=0; i<out_channels; i++) {
 			for (int j=0; j<info.blocksize_1/4; j++)
 				mdctright[i][j] = 0;
+			mdctright_silent[i] = true;
 		}
+		mdct_lap_init(laps, info.blocksize_0 / options.decimation, info.blocksize_1 / options.decimation);
+	}
+	
+	first_packet = true;
+}
+
+double VorbisDecoder::replaygain() {
+	if (options.replaygain == REPLAYGAIN_OFF)
+		return 1;
+	
+	const char *gain_tag = "REPLAYGAIN_TRACK_GAIN";
+	const char *peak_tag = "REPLAYGAIN_TRACK_PEAK";
+	const char *other_gain_tag = "REPLAYGAIN_ALBUM_GAIN";
+	const char *other_peak_tag = "REPLAYGAIN_ALBUM_PEAK";
+	if (options.replaygain == REPLAYGAIN_ALBUM) {
+		gain_tag = other_gain_tag;
+		peak_tag = other_peak_tag;
+		other_gain_tag = "REPLAYGAIN_TRACK_GAIN";
+		other_peak_tag = "REPLAYGAIN_TRACK_PEAK";
+	}
+	
+	double db;
+	if (!comment_number(gain_tag, &db)) {
+		gain_tag = other_gain_tag;
+		peak_tag = other_peak_tag;
+		if (!comment_number(gain_tag, &db))
+			return 1;
+	}
+	
+	// A preamp past +-15 dB is a typo rather than a level to aim for,
+	// and anything past +-60 dB in all is a broken tag
+	double preamp = options.replaygain_preamp;
+	if (!(preamp > -15))
+		preamp = -15;
+	else if (preamp > 15)
+		preamp = 15;
+	db += preamp;
+	if (!(db > -60))
+		db = -60;
+	else if (db > 60)
+		db = 60;
+	double gain = pow(10.0, db / 20);
+	double peak;
+	if (comment_number(peak_tag, &peak) && peak > 0 && gain * peak > 1)
+		gain = 1 / peak;
+	
+	if (debug) cout << gain_tag << " " << db << " dB, scale " << gain << endl;
+	return gain;
+}
+
+bool VorbisDecoder::comment_number(const char *name, double *value) {
+	int length;
+	const char *text = comment(name, &length);
+	if (text == NULL)
+		return false;
+	
+	// Values aren't NUL terminated, and a number doesn't need many bytes
+	char number[32];
+	if (length > 31)
+		length = 31;
+	memcpy(number, text, length);
+	number[length] = 0;
+	
+	char *end;
+	*value = strtod(number, &end);
+	return end != number && *value - *value == 0; // Reject NaN and infinities
+}
+
+void VorbisDecoder::init_output() {
+	mdctright = new int*[out_channels];
+	mdctright_silent = new bool[out_channels];
+	for (int i=0; i<out_channels; i++) {
+		mdctright[i] = new int[info.blocksize_1/4];
+		for (int j=0; j<info.blocksize_1/4; j++)
+			mdctright[i][j] = 0;
+		mdctright_silent[i] = true;
+	}
+	mdct_lap_init(laps, info.blocksize_0 / options.decimation, info.blocksize_1 / options.decimation);
+	
+	// A packet yields at most blocksize_1/2 samples per channel, before
+	// any rate conversion
+	int packet_max = info.blocksize_1/2 / options.decimation;
+	resampler = NULL;
+	resample_in = NULL;
+	resample_out = NULL;
+	int rate = info.audio_sample_rate / options.decimation;
+	if (options.resample_rate > 0 && options.resample_rate != rate) {
+		resampler = new Resampler(rate, options.resample_rate, out_channels, packet_max);
+		resample_in = new ogg_int32_t[packet_max];
+		packet_max = resampler->max_output(packet_max) + resampler->taps;
+		resample_out = new ogg_int32_t[packet_max];
+	}
+	pcm_capacity = packet_max * PCM_BLOCK_FRAMES;
+	pcm_fill = 0;
+	pcmout = new char[pcm_capacity * out_channels * pcm_bytes];
+	sink->output_started(out_channels, pcm_bytes);
+	
+	output_ready = true;
+}
+
+void VorbisDecoder::close_output() {
+	if (!output_ready)
+		return;
+	
+	if (resampler != NULL)
+		drain_resampler();
+	flush_pcm();
+	free_output();
+	output_ready = false;
+}
+
+void VorbisDecoder::free_output() {
+	for (int i=0; i<out_channels; i++)
+		delete [] mdctright[i];
+	delete [] mdctright;
+	delete [] mdctright_silent;
+	delete [] pcmout;
+	delete [] downmix;
+	delete resampler;
+	delete [] resample_in;
+	delete [] resample_out;
+}
 
+void VorbisDecoder::free_comments() {
+	delete [] info.comment_data;
+	delete [] info.user_comment;
+	delete [] info.user_comment_length;
+	info.comment_data = NULL;
+	info.vendor_length = 0;
+	info.vendor_string = NULL;
+	info.user_comment_list_length = 0;
+	info.user_comment = NULL;
+	info.user_comment_length = NULL;
+}
 
-		// Writes a wav header (for testing)
-		/*
-		unsigned int wave_magic[11] = { 0x46464952, 0x00056424, 0x45564157, 0x20746d66, 0x00000010, 0x00010001, 0x0000ac44, 0x00015888, 0x00100002, 0x61746164, 0x00056400 };
-		for (int i=0; i<11; i++) {
-			fwrite(&(wave_magic[i]), 4, 1, stdout);
+const char *VorbisDecoder::comment(const char *name, int *length, int index) {
+	int name_length = strlen(name);
+	for (int i=0; i<info.user_comment_list_length; i++) {
+		const char *c = info.user_comment[i];
+		if (info.user_comment_length[i] <= name_length || c[name_length] != '=')
+			continue;
+		
+		bool match = true;
+		for (int j=0; j<name_length && match; j++) {
+			char a = c[j];
+			char b = name[j];
+			if (a >= 'a' && a <= 'z') a -= 'a' - 'A';
+			if (b >= 'a' && b <= 'z') b -= 'a' - 'A';
+			match = (a == b);
 		}
-		*/
 		
-		while (!file->eof) {
-			init_vorbis_packet();
-			decode_audio();
+		if (match && index-- == 0) {
+			*length = info.user_comment_length[i] - name_length - 1;
+			return c + name_length + 1;
 		}
-		
-		// Cleanup
-		for (int i=0; i<info.audio_channels; i++)
-			delete mdctright[i];
-		delete mdctright;
-		delete pcmout;
 	}
+	return NULL;
+}
+
+void VorbisDecoder::free_setup() {
+	for (int i=0; i<info.vorbis_codebook_count; i++) {
+		delete [] info.codebook_config[i].codeword_lengths;
+		delete [] info.codebook_config[i].multiplicands;
+		delete info.codebook_config[i].htree;
+	}
+	delete [] info.codebook_config;
 	
-	/**
-	 * Reads in and verifies the ogg header - program exits in case of bad header
-	 */
-	void read_ogg_header() {
-		int *in = new int[8];
-		
-		// Magic capture pattern "OggS"
-		page.capture_pattern = 0;
-		file->readbytes(in, 4);
-		for (int i=0; i<4; i++) // This could potentially be worked around
-			page.capture_pattern |= ((in[i]&0xFF) << (i*8));
-		
-		if (page.capture_pattern != 0x5367674F) {
-			cout << "Error: Magic capture pattern \"OggS\" not found" << endl;
-			exit(1);
+	for (int i=0; i<info.vorbis_floor_count; i++) {
+		if (info.vorbis_floor_types[i] != 1)
+			continue;
+		Floor1 *floor = &info.floor_config[i];
+		if (floor->subclass_books != NULL) {
+			for (int j=0; j<=floor->maximum_class; j++)
+				delete [] floor->subclass_books[j];
 		}
-		
-		// Version
-		file->readbytes(in, 1);
-		page.version = in[0];
-		
-		if (page.version != 0) {
-			cout << "Error: Not Ogg version 0" << endl;
-			exit(1);
+		delete [] floor->partition_class_list;
+		delete [] floor->class_dimensions;
+		delete [] floor->class_subclasses;
+		delete [] floor->class_masterbooks;
+		delete [] floor->subclass_books;
+		delete [] floor->X_list;
+	}
+	delete [] info.floor_config;
+	delete [] info.vorbis_floor_types;
+	
+	for (int i=0; i<info.vorbis_residue_count; i++) {
+		if (info.residue_config[i].books != NULL) {
+			for (int j=0; j<info.residue_config[i].classifications; j++)
+				delete [] info.residue_config[i].books[j];
 		}
-		
-		// Header type
-		file->readbytes(in, 1);
-		page.header_type = in[0];
-		
-		if (page.header_type < 0 || page.header_type > 7) {
-			cout << "Error: Illegal header type" << endl;
-			exit(1);
+		delete [] info.residue_config[i].books;
+		delete [] info.residue_config[i].cascade;
+	}
+	delete [] info.residue_config;
+	delete [] info.vorbis_residue_types;
+	
+	for (int i=0; i<info.vorbis_mapping_count; i++) {
+		delete [] info.mapping_config[i].magnitude;
+		delete [] info.mapping_config[i].angle;
+		delete [] info.mapping_config[i].mux;
+		delete [] info.mapping_config[i].submap_floor;
+		delete [] info.mapping_config[i].submap_residue;
+	}
+	delete [] info.mapping_config;
+	
+	delete [] info.mode_config;
+	
+	info.vorbis_codebook_count = 0;
+	info.codebook_config = NULL;
+	info.vorbis_floor_count = 0;
+	info.floor_config = NULL;
+	info.vorbis_floor_types = NULL;
+	info.vorbis_residue_count = 0;
+	info.residue_config = NULL;
+	info.vorbis_residue_types = NULL;
+	info.vorbis_mapping_count = 0;
+	info.mapping_config = NULL;
+	info.vorbis_mode_count = 0;
+	info.mode_config = NULL;
+}
+
+void VorbisDecoder::build_downmix() {
+	out_channels = info.audio_channels;
+	downmix = NULL;
+	
+	int out = options.downmix_channels;
+	const double *matrix = options.downmix_matrix;
+	if (out > 0 && matrix != NULL && options.downmix_matrix_channels != info.audio_channels) {
+		// Written for another link's layout: its rows are the wrong length
+		if (warning) cout << "Warning: Downmix matrix doesn't fit this stream's channels; using the standard mix" << endl;
+		matrix = NULL;
+	}
+	if (out <= 0 || (out >= info.audio_channels && matrix == NULL))
+		return;
+	if (matrix == NULL && out > 2 && info.audio_channels <= 8) {
+		if (warning) cout << "Warning: No standard mix to more than 2 channels; keeping them all" << endl;
+		return;
+	}
+	
+	out_channels = out;
+	downmix = new double[out * info.audio_channels];
+	if (matrix != NULL) {
+		for (int i=0; i<out * info.audio_channels; i++)
+			downmix[i] = matrix[i];
+		return;
+	}
+	
+	// Stereo gains for the Vorbis channel orders; the LFE is dropped
+	static const double stereo[8][2][8] = {
+		{ {1}, {1} }, // M
+		{ {1, 0}, {0, 1} }, // L R
+		{ {1, 0.7071, 0}, {0, 0.7071, 1} }, // L C R
+		{ {1, 0, 0.7071, 0}, {0, 1, 0, 0.7071} }, // FL FR RL RR
+		{ {1, 0.7071, 0, 0.7071, 0}, {0, 0.7071, 1, 0, 0.7071} }, // FL C FR RL RR
+		{ {1, 0.7071, 0, 0.7071, 0, 0}, {0, 0.7071, 1, 0, 0.7071, 0} }, // FL C FR RL RR LFE
+		{ {1, 0.7071, 0, 0.7071, 0, 0.5, 0}, {0, 0.7071, 1, 0, 0.7071, 0.5, 0} }, // FL C FR SL SR RC LFE
+		{ {1, 0.7071, 0, 0.7071, 0, 0.7071, 0, 0}, {0, 0.7071, 1, 0, 0.7071, 0, 0.7071, 0} } // FL C FR SL SR RL RR LFE
+	};
+	
+	for (int i=0; i<out; i++) {
+		double sum = 0;
+		for (int c=0; c<info.audio_channels; c++) {
+			double gain;
+			if (info.audio_channels > 8) // Application defined order: alternate sides
+				gain = (out == 1 || c % out == i ? 1 : 0);
+			else if (out == 1)
+				gain = stereo[info.audio_channels-1][0][c] + stereo[info.audio_channels-1][1][c];
+			else
+				gain = stereo[info.audio_channels-1][i][c];
+			downmix[i*info.audio_channels + c] = gain;
+			sum += gain;
 		}
 		
-		// Granule position
-		page.granule_position = 0;
-		file->readbytes(in, 8);
-		for (int i=0; i<8; i++)
-			page.granule_position |= ((in[i]&0xFF) << (i*8));
-		
-		// Bitstream serial number
-		page.bitstream_serial_number = 0;
-		file->readbytes(in, 4);
-		for (int i=0; i<4; i++)
-			page.bitstream_serial_number |= ((in[i]&0xFF) << (i*8));
-		
-		// Page sequence number
-		page.sequence_number = 0;
-		file->readbytes(in, 4);
-		for (int i=0; i<4; i++)
-			page.sequence_number |= ((in[i]&0xFF) << (i*8));
-		
-		// CRC checksum
-		page.CRC_checksum = 0;
-		file->readbytes(in, 4);
-		for (int i=0; i<4; i++)
-			page.CRC_checksum |= ((in[i]&0xFF) << (i*8));
-		
-		// Page segments
-		file->readbytes(in, 1);
-		page.segments = in[0];
-		
-		// Segment table
-		delete page.segment_table; // This should probably be moved somewhere better...
-		page.segment_table = new int[page.segments];  // !5
-		file->readbytes(page.segment_table, page.segments);
-		
-		// Page data length
-		page.data_length = 0;
-		for (int i=0; i<page.segments; i++)
-			page.data_length += page.segment_table[i];
-		
-		// Page data
-		delete page.data; // This should probably be moved somewhere better...
-		page.data = new int[page.data_length];
-		file->readbytes(page.data, page.data_length);
-		
-		// Verify the CRC checksum
-		if (!verify_CRC_checksum()) {
-			cout << "Error: CRC checksum failed!" << endl;
-			exit(1);
+		// Normalize so the mix can't clip where its inputs don't. This
+		// costs level: 20*log10(sum) dB, 7.7 dB for 5.1's sides
+		for (int c=0; c<info.audio_channels && sum > 0; c++)
+			downmix[i*info.audio_channels + c] /= sum;
+	}
+}
+
+char *VorbisDecoder::pcm_channel_out(int channel, int *step) {
+	// Planar output gives each channel its own contiguous run
+	if (options.planar) {
+		*step = 1;
+		return pcmout + (channel*pcm_capacity + pcm_fill) * pcm_bytes;
+	}
+	*step = out_channels;
+	return pcmout + (pcm_fill*out_channels + channel) * pcm_bytes;
+}
+
+/**
+ * pcm_store, through the stream's limiter while it has one
+ */
+template <class PCM>
+static void store_limited(PCM &pcm, bool limiting, ogg_int32_t &gain, const ogg_int32_t *in, int n, typename PCM::sample_t *out, int step) {
+	if (limiting) {
+		pcm_limit<PCM> limit(pcm, gain);
+		pcm_store(limit, in, n, out, step);
+	} else
+		pcm_store(pcm, in, n, out, step);
+}
+
+void VorbisDecoder::store_channel(const ogg_int32_t *in, int n, char *out, int step) {
+	if (options.bits == 24) {
+		pcm_24 pcm;
+		store_limited(pcm, limiting, limit_gain, in, n, (ogg_int32_t *)out, step);
+	} else if (options.bits == 32) {
+		pcm_32 pcm;
+		store_limited(pcm, limiting, limit_gain, in, n, (ogg_int32_t *)out, step);
+	} else if (options.dither)
+		store_limited(dither, limiting, limit_gain, in, n, (ogg_int16_t *)out, step);
+	else {
+		pcm_16 pcm;
+		store_limited(pcm, limiting, limit_gain, in, n, (ogg_int16_t *)out, step);
+	}
+}
+
+void VorbisDecoder::drain_resampler() {
+	// Far below the input rate the drain is longer than a packet, and
+	// resample_in only holds one
+	int left = resampler->drain_length();
+	while (left > 0) {
+		int n = (left < resampler->max_block ? left : resampler->max_block);
+		for (int j=0; j<n; j++)
+			resample_in[j] = 0;
+		
+		if (pcm_fill + resampler->max_output(n) > pcm_capacity)
+			flush_pcm();
+		
+		int produced = 0;
+		for (int i=0; i<out_channels; i++) {
+			int step;
+			char *out = pcm_channel_out(i, &step);
+			produced = resampler->process(i, resample_in, n, resample_out);
+			store_channel(resample_out, produced, out, step);
 		}
-		
-		page.packet.data_offset = 0;
-		page.packet.segment_offset = 0;
-		
-		delete in;
+		pcm_fill += produced;
+		left -= n;
+	}
+}
+
+void VorbisDecoder::flush_pcm() {
+	if (pcm_fill > 0) {
+		if (options.planar) {
+			char **planes = new char*[out_channels];
+			for (int i=0; i<out_channels; i++)
+				planes[i] = pcmout + i*pcm_capacity*pcm_bytes;
+			sink->write_planar(planes, out_channels, pcm_fill * pcm_bytes);
+			delete [] planes;
+		} else
+			sink->write(pcmout, pcm_fill * out_channels * pcm_bytes);
 	}
+	pcm_fill = 0;
+}
+
+int VorbisDecoder::readbits(int bits) {
+	if (bits > 32) { // We return an int: don't try more than 32 bits
+		if (warning) cout << "Warning: Trying to read more than 32 bits!" << endl;
+		bits = 32;
+	}
+	STATS_ADD(bits_read, bits);
 	
-	/**
-	 * Verifies the CRC checksum of the header
-	 * @return True if verified, false if not
-	 */
-	bool verify_CRC_checksum() {
-		int CRC_register = 0;
-		
-		// Capture pattern
-		for (int i=0; i<4; i++)
-			CRC_register = (CRC_register<<8) ^ CRC_lookup[((CRC_register >> 24)&0xFF) ^ ((page.capture_pattern >> (i*8))&0xFF)];
-		
-		// Version
-		CRC_register = (CRC_register<<8) ^ CRC_lookup[((CRC_register >> 24)&0xFF) ^ (page.version&0xFF)];
-		
-		// Header type
-		CRC_register = (CRC_register<<8) ^ CRC_lookup[((CRC_register >> 24)&0xFF) ^ (page.header_type&0xFF)];
-		
-		// Granule position
-		for (int i=0; i<8; i++)
-			CRC_register = (CRC_register<<8) ^ CRC_lookup[((CRC_register >> 24)&0xFF) ^ (int)((page.granule_position >> (i*8))&0xFF)];
-		
-		// Bitstream serial number
-		for (int i=0; i<4; i++)
-			CRC_register = (CRC_register<<8) ^ CRC_lookup[((CRC_register >> 24)&0xFF) ^ ((page.bitstream_serial_number >> (i*8))&0xFF)];
+	int output = 0;
+	
+	for (int i=0; i<bits; i++) {
+		// If we've read to the end of this packet's data
+		if (page.packet.bytepos >= page.packet.length) {
+			if (!page.packet.end_of_packet && !file->eof) // Is it a page-spanning packet?
+				read_continuation_page(); // Set packet data to the next page's continuation
+			if (page.packet.bytepos >= page.packet.length) { // We tried to read past the true end of a packet (or file)
+				if (warning) cout << "Warning: Tried to read past the end of a packet" << endl;
+				break;
+			}
+		}
 		
-		// Page sequence number
-		for (int i=0; i<4; i++)
-			CRC_register = (CRC_register<<8) ^ CRC_lookup[((CRC_register >> 24)&0xFF) ^ ((page.sequence_number >> (i*8))&0xFF)];
+		output |= ((page.packet.data[page.packet.bytepos] >> page.packet.bitpos)&0x01) << i;
+		page.packet.bitpos++;
 		
-		// CRC checksum - zero'd out
-		for (int i=0; i<4; i++)
-			CRC_register = (CRC_register<<8) ^ CRC_lookup[((CRC_register >> 24)&0xFF)];
+		if (page.packet.bitpos == 8) {
+			page.packet.bytepos++;
+			page.packet.bitpos = 0;
+		}
+	}
+	
+	return output;
+}
+
+void VorbisDecoder::read_vorbis_id_header() {
+	// Packet type
+	int packet_type = readbits(8);
+	if (packet_type != 0x01) {
+		fail(VORBIS_ERR_HEADER, "Not a Vorbis ID header");
+		return;
+	}
+	
+	// Magic capture pattern "vorbis"
+	int vor = readbits(24);
+	int bis = readbits(24);
+	if (vor != 0x00726f76 && bis != 0x00736962) {
+		fail(VORBIS_ERR_HEADER, "Magic capture pattern \"vorbis\" not found");
+		return;
+	}
+	
+	// Vorbis version
+	int vorbis_version = readbits(32); // *
+	if (vorbis_version != 0) {
+		fail(VORBIS_ERR_HEADER, "Only Vorbis version 0 supported");
+		return;
+	}
+	
+	// Audio channels
+	info.audio_channels = readbits(8);
+	if (info.audio_channels == 0) {
+		fail(VORBIS_ERR_HEADER, "Must have at least one audio channel");
+		return;
+	}
+	
+	// Audio sample rate
+	info.audio_sample_rate = readbits(32); // *
+	if (info.audio_sample_rate == 0) {
+		fail(VORBIS_ERR_HEADER, "Sample rate must not be zero");
+		return;
+	}
+	
+	// Bitrate maximum
+	info.bitrate_maximum = readbits(32); // *
+	
+	// Bitrate nominal
+	info.bitrate_nominal = readbits(32); // *
+	
+	// Bitrate minimum
+	info.bitrate_minimum = readbits(32); // *
+	
+	// Blocksize 0
+	info.blocksize_0 = 1 << readbits(4);
+	bool legal = false;
+	for (int i=8; i<14; i++) {
+		if ((1<<i) == info.blocksize_0)
+			legal = true;
+	}
+	if (!legal) {
+		fail(VORBIS_ERR_HEADER, "Illegal blocksize_0");
+		return;
+	}
+	
+	// Blocksize 1
+	info.blocksize_1 = 1 << readbits(4);
+	legal = false;
+	for (int i=8; i<14; i++) {
+		if ((1<<i) == info.blocksize_1)
+			legal = true;
+	}
+	if (!legal) {
+		fail(VORBIS_ERR_HEADER, "Illegal blocksize_1");
+		return;
+	}
+	
+	if (info.blocksize_0 > info.blocksize_1) {
+		fail(VORBIS_ERR_HEADER, "blocksize_0 must be <= blocksize_1");
+		return;
+	}
+	
+	// Framing flag
+	int framing_flag = readbits(1);
+	if (framing_flag == 0) {
+		fail(VORBIS_ERR_HEADER, "ID framing flag not set");
+		return;
+	}
+}
+
+void VorbisDecoder::read_vorbis_comment_header() {
+	// Packet type
+	int packet_type = readbits(8);
+	if (packet_type != 0x03) {
+		fail(VORBIS_ERR_HEADER, "Not a Vorbis comment header");
+		return;
+	}
+	
+	// Magic capture pattern "vorbis"
+	int vor = readbits(24);
+	int bis = readbits(24);
+	if (vor != 0x00726f76 && bis != 0x00736962) {
+		fail(VORBIS_ERR_HEADER, "Magic capture pattern \"vorbis\" not found");
+		return;
+	}
+	
+	// The lengths are unsigned 32-bit: a "negative" one is corrupt
+	
+	// All the strings are copied into comment_data a run of bytes at a
+	// time, and sliced out of it once it's done growing
+	int capacity = 256;
+	int used = 0;
+	char *data = new char[capacity];
+	
+	// Vendor length
+	int vendor_length = readbits(32);
+	
+	// Vendor string
+	if (vendor_length < 0 || !read_comment_string(&data, &capacity, &used, vendor_length, true)) {
+		delete [] data;
+		fail(VORBIS_ERR_HEADER, "Comment header vendor string truncated");
+		return;
+	}
+	if (!valid_utf8(data, vendor_length)) {
+		if (warning) cout << "Warning: Vendor string is not UTF-8" << endl;
+		used = 0;
+		vendor_length = 0;
+	}
+	
+	// User comment list length
+	int list_length = readbits(32);
+	if (list_length < 0) {
+		delete [] data;
+		fail(VORBIS_ERR_HEADER, "Bad user comment list length");
+		return;
+	}
+	
+	// User comments; the list grows as comments actually turn up, so a
+	// corrupt list length can't force a huge allocation
+	int list_capacity = (list_length < 16 ? list_length : 16);
+	int kept = 0;
+	int *offset = new int[list_capacity];
+	int *length = new int[list_capacity];
+	for (int i=0; i<list_length; i++) {
+		int comment_length = readbits(32);
+		bool keep = (options.comment_limit <= 0 || comment_length <= options.comment_limit);
+		int start = used;
+		if (comment_length < 0 || !read_comment_string(&data, &capacity, &used, comment_length, keep)) {
+			delete [] data;
+			delete [] offset;
+			delete [] length;
+			fail(VORBIS_ERR_HEADER, "Comment header user comment truncated");
+			return;
+		}
+		if (!keep)
+			continue;
+		if (!valid_utf8(data + start, comment_length)) {
+			if (warning) cout << "Warning: Dropping a user comment that is not UTF-8" << endl;
+			used = start;
+			continue;
+		}
 		
-		// Page segments
-		CRC_register = (CRC_register<<8) ^ CRC_lookup[((CRC_register >> 24)&0xFF) ^ (page.segments&0xFF)];
+		if (kept == list_capacity) {
+			list_capacity *= 2;
+			int *grown_offset = new int[list_capacity];
+			int *grown_length = new int[list_capacity];
+			for (int j=0; j<kept; j++) {
+				grown_offset[j] = offset[j];
+				grown_length[j] = length[j];
+			}
+			delete [] offset;
+			delete [] length;
+			offset = grown_offset;
+			length = grown_length;
+		}
+		offset[kept] = start;
+		length[kept] = comment_length;
+		kept++;
+	}
+	
+	info.comment_data = data;
+	info.vendor_length = vendor_length;
+	info.vendor_string = data;
+	info.user_comment_list_length = kept;
+	info.user_comment_length = length;
+	info.user_comment = new const char *[kept];
+	for (int i=0; i<kept; i++)
+		info.user_comment[i] = data + offset[i];
+	delete [] offset;
+	
+	// Framing bit
+	int framing_flag = readbits(1);
+	if (framing_flag != 1) {
+		fail(VORBIS_ERR_HEADER, "Comment framing bit is not set");
+		return;
+	}
+}
+
+bool VorbisDecoder::read_comment_string(char **data, int *capacity, int *used, int length, bool keep) {
+	while (length > 0) {
+		if (page.packet.bytepos >= page.packet.length) {
+			if (page.packet.end_of_packet || file->eof || !read_continuation_page())
+				return false;
+			continue;
+		}
 		
-		// Segment table
-		for (int i=0; i<page.segments; i++)
-			CRC_register = (CRC_register<<8) ^ CRC_lookup[((CRC_register >> 24)&0xFF) ^ ((page.segment_table[i])&0xFF)];
+		int n = page.packet.length - page.packet.bytepos;
+		if (n > length)
+			n = length;
+		
+		if (keep) {
+			if (*used + n > *capacity) {
+				int grown_capacity = *capacity * 2;
+				if (grown_capacity < *used + n)
+					grown_capacity = *used + n;
+				char *grown = new char[grown_capacity];
+				memcpy(grown, *data, *used);
+				delete [] *data;
+				*data = grown;
+				*capacity = grown_capacity;
+			}
+			const int *in = page.packet.data + page.packet.bytepos;
+			char *out = *data + *used;
+			for (int i=0; i<n; i++)
+				out[i] = (char)in[i];
+			*used += n;
+		}
 		
-		// Page data
-		for (int i=0; i<page.data_length; i++)
-			CRC_register = (CRC_register<<8) ^ CRC_lookup[((CRC_register >> 24)&0xFF) ^ ((page.data[i])&0xFF)];
+		page.packet.bytepos += n;
+		length -= n;
+	}
+	return true;
+}
+
+bool VorbisDecoder::valid_utf8(const char *s, int length) {
+	const unsigned char *p = (const unsigned char *)s;
+	const unsigned char *end = p + length;
+	while (p < end) {
+		unsigned char c = *p++;
+		if (c < 0x80)
+			continue;
+		
+		int more;
+		unsigned int min;
+		unsigned int code;
+		if ((c & 0xE0) == 0xC0) { more = 1; min = 0x80; code = c & 0x1F; }
+		else if ((c & 0xF0) == 0xE0) { more = 2; min = 0x800; code = c & 0x0F; }
+		else if ((c & 0xF8) == 0xF0) { more = 3; min = 0x10000; code = c & 0x07; }
+		else return false;
+		
+		if (end - p < more)
+			return false;
+		for (int i=0; i<more; i++) {
+			if ((p[i] & 0xC0) != 0x80)
+				return false;
+			code = (code << 6) | (p[i] & 0x3F);
+		}
+		p += more;
 		
-		if (CRC_register == page.CRC_checksum)
-			return true;
-		else
+		if (code < min || code > 0x10FFFF || (code >= 0xD800 && code <= 0xDFFF))
 			return false;
 	}
+	return true;
+}
+
+int VorbisDecoder::ilog(int x) {
+	int return_value = 0;
+	while (x > 0) {
+		return_value++;
+		x >>= 1;
+	}
 	
-	/**
-	 * When a new packet (or packet segment) is needed, this function will
-	 * set up the Packet structure accordingly
-	 */
-	void init_vorbis_packet() {
-		// If the last packet of the last page didn't span a page boundary,
-		// i.e. it ended exactly at the page's end, then we need a new page header
-		if (page.packet.segment_offset >= page.segments)
-			read_ogg_header();
-		
-		int len = 0;
-		bool end_of_packet = false;
-		int i;
-		// Get the length of the new packet
-		for (i=page.packet.segment_offset; i<page.segments && !end_of_packet; i++) {
-			len += page.segment_table[i];
-			if (page.segment_table[i] < 255)
-				end_of_packet = true;
+	return return_value;
+}
+
+float VorbisDecoder::float32_unpack(int x) {
+	int mantissa = x & 0x1FFFFF; // * Unsigned
+	int sign = x & 0x80000000; // * Unsigned
+	int exponent = (x & 0x7FE00000) >> 21; // * Unsigned
+	if (sign != 0)
+		mantissa *= -1;
+	return (mantissa * (float)(1 << (exponent - 788)));
+}
+
+int VorbisDecoder::int32_pow(int base, int exp) {
+	int result = 1;
+	for (int i=0; i<exp; i++)
+		result *= base;
+	return (result);
+}
+
+int VorbisDecoder::lookup1_values(int entries, int dimensions) {
+	int return_value = 0;
+	while (int32_pow(return_value, dimensions) <= entries)
+		return_value++;
+	return (return_value - 1);
+}
+
+void VorbisDecoder::unpack_codebooks() {
+	// Codebook count
+	info.vorbis_codebook_count = readbits(8) + 1; // * Unsigned
+	
+	// Codebook decode
+	info.codebook_config = new Codebook[info.vorbis_codebook_count]();
+	for (int i=0; i<info.vorbis_codebook_count; i++) {
+		// Codebook sync pattern
+		int codebook_sync = readbits(24);
+		if (codebook_sync != 0x564342) {
+			fail(VORBIS_ERR_SETUP, "Codebook sync pattern not found");
+			return;
 		}
-		page.packet.length = len;
-		page.packet.end_of_packet = end_of_packet; // Does this packet end on this page?
-		page.packet.segment_offset = i; // How far we've read in the segment table
 		
-		delete page.packet.data; // This should probably be moved somewhere better...
-		page.packet.data = new int[page.packet.length];
-		for (int j=0; j<page.packet.length; j++) // Copy over the data
-			page.packet.data[j] = page.data[j + page.packet.data_offset];
+		// Codebook dimensions
+		info.codebook_config[i].dimensions = readbits(16);
 		
-		page.packet.data_offset += page.packet.length; // Update the packet data offset
+		// Codebook entries
+		info.codebook_config[i].entries = readbits(24);
 		
-		page.packet.bytepos = 0; // Reset read byte position
-		page.packet.bitpos = 0; // Reset read bit position
-	}
-	
-	/**
-	 * Reads up to 32 of the next bits from the packet's data
-	 * @param bits The number of bits to read in
-	 * @return An int containing the bits in the order read from LSB to MSB
-	 */
-	int readbits(int bits) {
-		if (bits > 32) { // We return an int: don't try more than 32 bits
-			if (warning) cout << "Warning: Trying to read more than 32 bits!" << endl;
-			bits = 32;
-		}
-		
-		int output = 0;
+		// Ordered flag
+		info.codebook_config[i].ordered = readbits(1);
 		
-		for (int i=0; i<bits; i++) {
-			// If we've read to the end of this packet's data
-			if (page.packet.bytepos >= page.packet.length) {
-				if (!page.packet.end_of_packet) { // Is it a page-spanning packet?
-					read_ogg_header(); // Read in the next page
-					
-					page.packet.data_offset = 0; // Reset data values
-					page.packet.segment_offset = 0;
-					init_vorbis_packet(); // Set packet data to new page's continuation
+		// Codeword lengths
+		info.codebook_config[i].codeword_lengths = new int[info.codebook_config[i].entries];
+		if (info.codebook_config[i].ordered == 0) { // If the codeword list is not ordered
+			info.codebook_config[i].sparse = readbits(1);
+			
+			for (int j=0; j<info.codebook_config[i].entries; j++) {
+				if (info.codebook_config[i].sparse == 1) { // If the codeword list is sparsely populated
+					int flag = readbits(1);
+					if (flag == 1) // This entry is set
+						info.codebook_config[i].codeword_lengths[j] = readbits(5) + 1;
+					else // This entry is unused
+						info.codebook_config[i].codeword_lengths[j] = -1;
+				} else // The codeword list is packed
+					info.codebook_config[i].codeword_lengths[j] = readbits(5) + 1;
+			}
+		} else { // The codeword list is length ordered
+			int current_entry = 0;
+			int current_length = readbits(5) + 1;
+			while (current_entry < info.codebook_config[i].entries) {
+				int number = readbits(ilog(info.codebook_config[i].entries - current_entry));
+				if (current_entry + number > info.codebook_config[i].entries) {
+					fail(VORBIS_ERR_SETUP, "Codebook entry > total entry number");
+					return;
 				}
-				else { // We tried to read past the true end of a packet
-					if (warning) cout << "Warning: Tried to read past the end of a packet" << endl;
-					break;
+				for (int j=0; j<number; j++)
+					info.codebook_config[i].codeword_lengths[current_entry + j] = current_length;
+				current_entry += number;
+				current_length++;
+				
+				if (current_entry < info.codebook_config[i].entries && current_length > 32) {
+					fail(VORBIS_ERR_SETUP, "Codebook codeword lengths run past 32 bits");
+					return;
 				}
 			}
-			
-			output |= ((page.packet.data[page.packet.bytepos] >> page.packet.bitpos)&0x01) << i;
-			page.packet.bitpos++;
-			
-			if (page.packet.bitpos == 8) {
-				page.packet.bytepos++;
-				page.packet.bitpos = 0;
-			}
 		}
 		
-		return output;
-	}
-	
-	/**
-	 * Reads values in from the Vorbis ID header packet
-	 */
-	void read_vorbis_id_header() {
-		// Packet type
-		int packet_type = readbits(8);
-		if (packet_type != 0x01) {
-			cout << "Error: Not a Vorbis ID header" << endl;
-			exit(1);
-		}
-		
-		// Magic capture pattern "vorbis"
-		int vor = readbits(24);
-		int bis = readbits(24);
-		if (vor != 0x00726f76 && bis != 0x00736962) {
-			cout << "Error: Magic capture pattern \"vorbis\" not found" << endl;
-			exit(1);
-		}
+		// Codebook lookup type
+		info.codebook_config[i].lookup_type = readbits(4);
 		
-		// Vorbis version
-		int vorbis_version = readbits(32); // *
-		if (vorbis_version != 0) {
-			cout << "Error: Only Vorbis version 0 supported" << endl;
-			exit(1);
+		if (info.codebook_config[i].lookup_type == 0) { // No lookups
+			; // Do nothing
+		} else if (info.codebook_config[i].lookup_type == 1) { // Type 1
+			info.codebook_config[i].minimum_value = float32_unpack(readbits(32)); // *
+			info.codebook_config[i].delta_value = float32_unpack(readbits(32)); // *
+			info.codebook_config[i].value_bits = readbits(4) + 1;
+			info.codebook_config[i].sequence_p = readbits(1);
+			
+			info.codebook_config[i].lookup_values = lookup1_values(info.codebook_config[i].entries, info.codebook_config[i].dimensions);
+			
+			info.codebook_config[i].multiplicands = new int[info.codebook_config[i].lookup_values];
+			for (int j=0; j<info.codebook_config[i].lookup_values; j++)
+				info.codebook_config[i].multiplicands[j] = readbits(info.codebook_config[i].value_bits);
+		} else if (info.codebook_config[i].lookup_type == 2) { // Type 2
+			info.codebook_config[i].minimum_value = float32_unpack(readbits(32)); // *
+			info.codebook_config[i].delta_value = float32_unpack(readbits(32)); // *
+			info.codebook_config[i].value_bits = readbits(4) + 1;
+			info.codebook_config[i].sequence_p = readbits(1);
+			
+			info.codebook_config[i].lookup_values = info.codebook_config[i].entries * info.codebook_config[i].dimensions;
+			
+			info.codebook_config[i].multiplicands = new int[info.codebook_config[i].lookup_values];
+			for (int j=0; j<info.codebook_config[i].lookup_values; j++)
+				info.codebook_config[i].multiplicands[j] = readbits(info.codebook_config[i].value_bits);
+		} else {
+			fail(VORBIS_ERR_SETUP, "Illegal codebook lookup type");
+			return;
 		}
 		
-		// Audio channels
-		info.audio_channels = readbits(8);
-		if (info.audio_channels == 0) {
-			cout << "Error: Must have at least one audio channel" << endl;
-			exit(1);
-		}
-		
-		// Audio sample rate
-		info.audio_sample_rate = readbits(32); // *
-		if (info.audio_sample_rate == 0) {
-			cout << "Error: Sample rate must not be zero" << endl;
-			exit(1);
-		}
-		
-		// Bitrate maximum
-		info.bitrate_maximum = readbits(32); // *
-		
-		// Bitrate nominal
-		info.bitrate_nominal = readbits(32); // *
-		
-		// Bitrate minimum
-		info.bitrate_minimum = readbits(32); // *
-		
-		// Blocksize 0
-		info.blocksize_0 = 1 << readbits(4);
-		bool legal = false;
-		for (int i=8; i<14; i++) {
-			if ((1<<i) == info.blocksize_0)
-				legal = true;
-		}
-		if (!legal) {
-			cout << "Error: Illegal blocksize_0" << endl;
-			exit(1);
-		}
-		
-		// Blocksize 1
-		info.blocksize_1 = 1 << readbits(4);
-		legal = false;
-		for (int i=8; i<14; i++) {
-			if ((1<<i) == info.blocksize_1)
-				legal = true;
-		}
-		if (!legal) {
-			cout << "Error: Illegal blocksize_1" << endl;
-			exit(1);
-		}
-		
-		if (info.blocksize_0 > info.blocksize_1) {
-			cout << "Error: blocksize_0 must be <= blocksize_1" << endl;
-			exit(1);
-		}
-		
-		// Framing flag
-		int framing_flag = readbits(1);
-		if (framing_flag == 0) {
-			cout << "Error: ID framing flag not set" << endl;
-			exit(1);
+		// Build Huffman tree
+		info.codebook_config[i].htree = new HuffmanTree();
+		for (int j=0; j<info.codebook_config[i].entries; j++) {
+			info.codebook_config[i].htree->AddNode(info.codebook_config[i].codeword_lengths[j], j);
 		}
 	}
-	
-	/**
-	 * Reads values in from the Vorbis comment header packet
-	 */
-	void read_vorbis_comment_header() {
-		// Packet type
-		int packet_type = readbits(8);
-		if (packet_type != 0x03) {
-			cout << "Error: Not a Vorbis comment header" << endl;
-			exit(1);
-		}
-		
-		// Magic capture pattern "vorbis"
-		int vor = readbits(24);
-		int bis = readbits(24);
-		if (vor != 0x00726f76 && bis != 0x00736962) {
-			cout << "Error: Magic capture pattern \"vorbis\" not found" << endl;
-			exit(1);
-		}
-		
-		// Any of the variables marked with a * might mess up
-		// if the read-in value was somehow large enough to reach 2's
-		// complement negatives (negative array index).  That is, they
-		// are intended to be read as unsigned variables
-		
-		// Vendor length
-		info.vendor_length = readbits(32); // *
-		
-		// Vendor string
-		info.vendor_string = new int[info.vendor_length];
-		for (int i=0; i<info.vendor_length; i++)
-			info.vendor_string[i] = readbits(8);
-		
-		// User comment list length
-		info.user_comment_list_length = readbits(32); // *
-		
-		// User comments
-		info.user_comment = new int *[info.user_comment_list_length];
-		info.user_comment_length = new int[info.user_comment_list_length];
-		for (int i=0; i<info.user_comment_list_length; i++) {
-			info.user_comment_length[i] = readbits(32); // *
-			
-			info.user_comment[i] = new int[info.user_comment_length[i]];
-			for (int j=0; j<info.user_comment_length[i]; j++)
-				info.user_comment[i][j] = readbits(8);
-		}
-		
-		// Framing bit
-		int framing_flag = readbits(1);
-		if (framing_flag != 1) {
-			cout << "Error: Comment framing bit is not set" << endl;
-			exit(1);
+}
+
+void VorbisDecoder::unpack_time_domain_transforms() {
+	// Placeholder hooks in this version
+	info.vorbis_time_count = readbits(6) + 1;
+	for (int i=0; i<info.vorbis_time_count; i++) {
+		if (readbits(16) != 0) {
+			fail(VORBIS_ERR_SETUP, "Nonzero value encountered while unpacking time domain transforms");
+			return;
 		}
 	}
+}
+
+void VorbisDecoder::unpack_floors() {
+	// Floor count
+	info.vorbis_floor_count = readbits(6) + 1;
 	
-	
-	/**
-	 * Calculates the base 2 logarithm of an integer in 2's complement
-	 * @param x The integer to find the log of
-	 * @return The log of x
-	 */
-	int ilog(int x) {
-		int return_value = 0;
-		while (x > 0) {
-			return_value++;
-			x >>= 1;
-		}
-		
-		return return_value;
-	}
-	
-	/**
-	 * Unpacks a Vorbis float32 into a native float32
-	 * @param x A Vorbis float32
-	 * @return The unpacked native float32
-	 */
-	float float32_unpack(int x) {
-		int mantissa = x & 0x1FFFFF; // * Unsigned
-		int sign = x & 0x80000000; // * Unsigned
-		int exponent = (x & 0x7FE00000) >> 21; // * Unsigned
-		if (sign != 0)
-			mantissa *= -1;
-		return (mantissa * (float)(1 << (exponent - 788)));
-	}
-	
-	/**
-	 * Raises a number to an integral power
-	 * @param base The base number
-	 * @param exp The exponent to be raised to
-	 * @return Base raised to the exponent power
-	 */
-	int int32_pow(int base, int exp) {
-		int result = 1;
-		for (int i=0; i<exp; i++)
-			result *= base;
-		return (result);
-	}
-	
-	/**
-	 * Computes the correct length of the value index for a
-	 * codebook VQ lookup table of lookup type 1
-	 * @param entries The number of entries in the codebook
-	 * @param dimensions The dimensions of the codebook
-	 * @return The correct length
-	 */
-	int lookup1_values(int entries, int dimensions) {
-		int return_value = 0;
-		while (int32_pow(return_value, dimensions) <= entries)
-			return_value++;
-		return (return_value - 1);
-	}
-	
-	/**
-	 * Unpack codebooks
-	 */
-	void unpack_codebooks() {
-		// Codebook count
-		info.vorbis_codebook_count = readbits(8) + 1; // * Unsigned
-		
-		// Codebook decode
-		info.codebook_config = new Codebook[info.vorbis_codebook_count];
-		for (int i=0; i<info.vorbis_codebook_count; i++) {
-			// Codebook sync pattern
-			int codebook_sync = readbits(24);
-			if (codebook_sync != 0x564342) {
-				cout << "Error: Codebook sync pattern not found" << endl;
-				exit(1);
-			}
+	info.floor_config = new Floor1[info.vorbis_floor_count]();
+	info.vorbis_floor_types = new int[info.vorbis_floor_count]();
+	for (int i=0; i<info.vorbis_floor_count; i++) {
+		// Floor type
+		info.vorbis_floor_types[i] = readbits(16);
+		
+		if (info.vorbis_floor_types[i] == 0) {
+			fail(VORBIS_ERR_SETUP, "Floor type zero unsupported");
+			return;
+		} else if (info.vorbis_floor_types[i] == 1) {
+			// Number of partitions
+			info.floor_config[i].partitions = readbits(5);
 			
-			// Codebook dimensions
-			info.codebook_config[i].dimensions = readbits(16);
-			
-			// Codebook entries
-			info.codebook_config[i].entries = readbits(24);
-			
-			// Ordered flag
-			info.codebook_config[i].ordered = readbits(1);
+			// Partition class list and maximum value therein
+			info.floor_config[i].partition_class_list = new int[info.floor_config[i].partitions];
+			info.floor_config[i].maximum_class = -1;
+			for (int j=0; j<info.floor_config[i].partitions; j++) {
+				info.floor_config[i].partition_class_list[j] = readbits(4);
+				if (info.floor_config[i].partition_class_list[j] > info.floor_config[i].maximum_class)
+					info.floor_config[i].maximum_class = info.floor_config[i].partition_class_list[j];
+			}
 			
-			// Codeword lengths
-			info.codebook_config[i].codeword_lengths = new int[info.codebook_config[i].entries];
-			if (info.codebook_config[i].ordered == 0) { // If the codeword list is not ordered
-				info.codebook_config[i].sparse = readbits(1);
+			info.floor_config[i].class_dimensions = new int[info.floor_config[i].maximum_class + 1];
+			info.floor_config[i].class_subclasses = new int[info.floor_config[i].maximum_class + 1];
+			info.floor_config[i].class_masterbooks = new int[info.floor_config[i].maximum_class + 1];
+			info.floor_config[i].subclass_books = new int*[info.floor_config[i].maximum_class + 1]();
+			for (int j=0; j<=info.floor_config[i].maximum_class; j++) {
+				// Class dimensions and number of subclasses
+				info.floor_config[i].class_dimensions[j] = readbits(3) + 1;
+				info.floor_config[i].class_subclasses[j] = readbits(2);
 				
-				for (int j=0; j<info.codebook_config[i].entries; j++) {
-					if (info.codebook_config[i].sparse == 1) { // If the codeword list is sparsely populated
-						int flag = readbits(1);
-						if (flag == 1) // This entry is set
-							info.codebook_config[i].codeword_lengths[j] = readbits(5) + 1;
-						else // This entry is unused
-							info.codebook_config[i].codeword_lengths[j] = -1;
-					} else // The codeword list is packed
-						info.codebook_config[i].codeword_lengths[j] = readbits(5) + 1;
+				// Masterbooks
+				if (info.floor_config[i].class_subclasses[j] != 0) {
+					info.floor_config[i].class_masterbooks[j] = readbits(8);
+					if (info.floor_config[i].class_masterbooks[j] > info.vorbis_codebook_count) {
+						fail(VORBIS_ERR_SETUP, "Floor 1 masterbook greater than valid codebook");
+						return;
+					}
 				}
-			} else { // The codeword list is length ordered
-				int current_entry = 0;
-				int current_length = readbits(5) + 1;
-				while (current_entry < info.codebook_config[i].entries) {
-					int number = readbits(ilog(info.codebook_config[i].entries - current_entry));
-					for (int j=0; j<number; j++)
-						info.codebook_config[i].codeword_lengths[j] = current_length;
-					current_entry += number;
-					current_length++;
-					
-					if (current_entry >= info.codebook_config[i].entries) { // Spec says >
-						cout << "Error: Codebook entry > total entry number" << endl;
-						exit(1);
+				
+				// Subclass books
+				info.floor_config[i].subclass_books[j] = new int[1 << info.floor_config[i].class_subclasses[j]];
+				for (int k=0; k<(1<<info.floor_config[i].class_subclasses[j]); k++) {
+					info.floor_config[i].subclass_books[j][k] = readbits(8) - 1;
+					if (info.floor_config[i].subclass_books[j][k] > info.vorbis_codebook_count) {
+						fail(VORBIS_ERR_SETUP, "Floor 1 subclass book greater than valid codebook");
+						return;
 					}
 				}
 			}
 			
-			// Codebook lookup type
-			info.codebook_config[i].lookup_type = readbits(4);
+			// Multiplier
+			info.floor_config[i].multiplier = readbits(2) + 1;
 			
-			if (info.codebook_config[i].lookup_type == 0) { // No lookups
-				; // Do nothing
-			} else if (info.codebook_config[i].lookup_type == 1) { // Type 1
-				info.codebook_config[i].minimum_value = float32_unpack(readbits(32)); // *
-				info.codebook_config[i].delta_value = float32_unpack(readbits(32)); // *
-				info.codebook_config[i].value_bits = readbits(4) + 1;
-				info.codebook_config[i].sequence_p = readbits(1);
-				
-				info.codebook_config[i].lookup_values = lookup1_values(info.codebook_config[i].entries, info.codebook_config[i].dimensions);
-				
-				info.codebook_config[i].multiplicands = new int[info.codebook_config[i].lookup_values];
-				for (int j=0; j<info.codebook_config[i].lookup_values; j++)
-					info.codebook_config[i].multiplicands[j] = readbits(info.codebook_config[i].value_bits);
-			} else if (info.codebook_config[i].lookup_type == 2) { // Type 2
-				info.codebook_config[i].minimum_value = float32_unpack(readbits(32)); // *
-				info.codebook_config[i].delta_value = float32_unpack(readbits(32)); // *
-				info.codebook_config[i].value_bits = readbits(4) + 1;
-				info.codebook_config[i].sequence_p = readbits(1);
-				
-				info.codebook_config[i].lookup_values = info.codebook_config[i].entries * info.codebook_config[i].dimensions;
-				
-				info.codebook_config[i].multiplicands = new int[info.codebook_config[i].lookup_values];
-				for (int j=0; j<info.codebook_config[i].lookup_values; j++)
-					info.codebook_config[i].multiplicands[j] = readbits(info.codebook_config[i].value_bits);
-			} else {
-				cout << "Error: Illegal codebook lookup type" << endl;
-				exit(1);
+			// Range bits
+			info.floor_config[i].rangebits = readbits(4);
+			
+			// Get number of floor values
+			info.floor_config[i].floor1_values = 2;
+			for (int j=0; j<info.floor_config[i].partitions; j++) {
+				int current_class_number = info.floor_config[i].partition_class_list[j];
+				for (int k=0; k<info.floor_config[i].class_dimensions[current_class_number]; k++) {
+					info.floor_config[i].floor1_values++;
+				}
 			}
 			
-			// Build Huffman tree
-			info.codebook_config[i].htree = new HuffmanTree();
-			for (int j=0; j<info.codebook_config[i].entries; j++) {
-				info.codebook_config[i].htree->AddNode(info.codebook_config[i].codeword_lengths[j], j);
+			// Read in the X coordinates
+			info.floor_config[i].X_list = new int[info.floor_config[i].floor1_values];
+			info.floor_config[i].X_list[0] = 0;
+			info.floor_config[i].X_list[1] = 1 << info.floor_config[i].rangebits;
+			info.floor_config[i].floor1_values = 2;
+			for (int j=0; j<info.floor_config[i].partitions; j++) {
+				int current_class_number = info.floor_config[i].partition_class_list[j];
+				for (int k=0; k<info.floor_config[i].class_dimensions[current_class_number]; k++) {
+					info.floor_config[i].X_list[info.floor_config[i].floor1_values] = readbits(info.floor_config[i].rangebits);
+					info.floor_config[i].floor1_values++;
+				}
 			}
 		}
-	}
-	
-	/**
-	 * Unpack time domain transforms; this part of the format is unused in this version
-	 */
-	void unpack_time_domain_transforms() {
-		// Placeholder hooks in this version
-		info.vorbis_time_count = readbits(6) + 1;
-		for (int i=0; i<info.vorbis_time_count; i++) {
-			if (readbits(16) != 0) {
-				cout << "Error: Nonzero value encountered while unpacking time domain transforms" << endl;
-				exit(1);
-			}
+		else {
+			fail(VORBIS_ERR_SETUP, "Invalid floor type");
+			return;
 		}
 	}
+}
+
+void VorbisDecoder::unpack_residues() {
+	// Residue count
+	info.vorbis_residue_count = readbits(6) + 1;
 	
-	/**
-	 * Unpack floors
-	 */
-	void unpack_floors() {
-		// Floor count
-		info.vorbis_floor_count = readbits(6) + 1;
-		
-		info.floor_config = new Floor1[info.vorbis_floor_count];
-		info.vorbis_floor_types = new int[info.vorbis_floor_count];
-		for (int i=0; i<info.vorbis_floor_count; i++) {
-			// Floor type
-			info.vorbis_floor_types[i] = readbits(16);
+	info.vorbis_residue_types = new int[info.vorbis_residue_count]();
+	info.residue_config = new Residue[info.vorbis_residue_count]();
+	for (int i=0; i<info.vorbis_residue_count; i++) {
+		// Residue type
+		info.vorbis_residue_types[i] = readbits(16);
+		
+		if (info.vorbis_residue_types[i] == 0 || info.vorbis_residue_types[i] == 1 || info.vorbis_residue_types[i] == 2) {
+			// "Bandpass" begin
+			info.residue_config[i].begin = readbits(24);
 			
-			if (info.vorbis_floor_types[i] == 0)
-				cout << "Error: Floor type zero unsupported" << endl;
-			else if (info.vorbis_floor_types[i] == 1) {
-				// Number of partitions
-				info.floor_config[i].partitions = readbits(5);
+			// "Bandpass" end
+			info.residue_config[i].end = readbits(24);
+			
+			// Partition size
+			info.residue_config[i].partition_size = readbits(24) + 1;
+			
+			// Classifications
+			info.residue_config[i].classifications = readbits(6) + 1;
+			
+			// Classbook
+			info.residue_config[i].classbook = readbits(8);
+			
+			// Cascade vector
+			info.residue_config[i].cascade = new int[info.residue_config[i].classifications];
+			for (int j=0; j<info.residue_config[i].classifications; j++) {
+				int high_bits = 0;
+				int low_bits = readbits(3);
+				int bitflag = readbits(1);
 				
-				// Partition class list and maximum value therein
-				info.floor_config[i].partition_class_list = new int[info.floor_config[i].partitions];
-				info.floor_config[i].maximum_class = -1;
-				for (int j=0; j<info.floor_config[i].partitions; j++) {
-					info.floor_config[i].partition_class_list[j] = readbits(4);
-					if (info.floor_config[i].partition_class_list[j] > info.floor_config[i].maximum_class)
-						info.floor_config[i].maximum_class = info.floor_config[i].partition_class_list[j];
-				}
+				if (bitflag == 1)
+					high_bits = readbits(5);
 				
-				info.floor_config[i].class_dimensions = new int[info.floor_config[i].maximum_class + 1];
-				info.floor_config[i].class_subclasses = new int[info.floor_config[i].maximum_class + 1];
-				info.floor_config[i].class_masterbooks = new int[info.floor_config[i].maximum_class + 1];
-				info.floor_config[i].subclass_books = new int*[info.floor_config[i].maximum_class + 1];
-				for (int j=0; j<=info.floor_config[i].maximum_class; j++) {
-					// Class dimensions and number of subclasses
-					info.floor_config[i].class_dimensions[j] = readbits(3) + 1;
-					info.floor_config[i].class_subclasses[j] = readbits(2);
-					
-					// Masterbooks
-					if (info.floor_config[i].class_subclasses[j] != 0) {
-						info.floor_config[i].class_masterbooks[j] = readbits(8);
-						if (info.floor_config[i].class_masterbooks[j] > info.vorbis_codebook_count) {
-							cout << "Error: Floor 1 masterbook greater than valid codebook" << endl;
-							exit(1);
-						}
-					}
-					
-					// Subclass books
-					info.floor_config[i].subclass_books[j] = new int[1 << info.floor_config[i].class_subclasses[j]];
-					for (int k=0; k<(1<<info.floor_config[i].class_subclasses[j]); k++) {
-						info.floor_config[i].subclass_books[j][k] = readbits(8) - 1;
-						if (info.floor_config[i].subclass_books[j][k] > info.vorbis_codebook_count) {
-							cout << "Error: Floor 1 subclass book greater than valid codebook" << endl;
-							exit(1);
+				info.residue_config[i].cascade[j] = high_bits * 8 + low_bits;
+			}
+			
+			// Book numbers
+			info.residue_config[i].books = new int*[info.residue_config[i].classifications]();
+			for (int j=0; j<info.residue_config[i].classifications; j++) {
+				info.residue_config[i].books[j] = new int[8];
+				for (int k=0; k<8; k++) {
+					// If bit k of cascade[j] is set
+					if (((info.residue_config[i].cascade[j] >> k) & 0x01) == 1) {
+						info.residue_config[i].books[j][k] = readbits(8);
+						if (info.residue_config[i].books[j][k] > info.vorbis_codebook_count) {
+							fail(VORBIS_ERR_SETUP, "Residue book greater than valid codebook");
+							return;
 						}
 					}
+					else
+						info.residue_config[i].books[j][k] = -1;
 				}
-				
-				// Multiplier
-				info.floor_config[i].multiplier = readbits(2) + 1;
-				
-				// Range bits
-				info.floor_config[i].rangebits = readbits(4);
-				
-				// Get number of floor values
-				info.floor_config[i].floor1_values = 2;
-				for (int j=0; j<info.floor_config[i].partitions; j++) {
-					int current_class_number = info.floor_config[i].partition_class_list[j];
-					for (int k=0; k<info.floor_config[i].class_dimensions[current_class_number]; k++) {
-						info.floor_config[i].floor1_values++;
-					}
-				}
-				
-				// Read in the X coordinates
-				info.floor_config[i].X_list = new int[info.floor_config[i].floor1_values];
-				info.floor_config[i].X_list[0] = 0;
-				info.floor_config[i].X_list[1] = 1 << info.floor_config[i].rangebits;
-				info.floor_config[i].floor1_values = 2;
-				for (int j=0; j<info.floor_config[i].partitions; j++) {
-					int current_class_number = info.floor_config[i].partition_class_list[j];
-					for (int k=0; k<info.floor_config[i].class_dimensions[current_class_number]; k++) {
-						info.floor_config[i].X_list[info.floor_config[i].floor1_values] = readbits(info.floor_config[i].rangebits);
-						info.floor_config[i].floor1_values++;
-					}
-				}
-			}
-			else {
-				cout << "Error: Invalid floor type" << endl;
-				exit(1);
 			}
+		} else {
+			fail(VORBIS_ERR_SETUP, "Invalid residue type");
+			return;
 		}
 	}
+}
+
+void VorbisDecoder::unpack_mappings() {
+	// Mapping count
+	info.vorbis_mapping_count = readbits(6) + 1;
 	
-	/**
-	 * Unpack residues
-	 */
-	void unpack_residues() {
-		// Residue count
-		info.vorbis_residue_count = readbits(6) + 1;
-		
-		info.vorbis_residue_types = new int[info.vorbis_residue_count];
-		info.residue_config = new Residue[info.vorbis_residue_count];
-		for (int i=0; i<info.vorbis_residue_count; i++) {
-			// Residue type
-			info.vorbis_residue_types[i] = readbits(16);
+	info.mapping_config = new Mapping[info.vorbis_mapping_count]();
+	for (int i=0; i<info.vorbis_mapping_count; i++) {
+		int mapping_type = readbits(16);
+		if (mapping_type == 0) {
+			// Submaps
+			if (readbits(1) == 1)
+				info.mapping_config[i].submaps = readbits(4) + 1;
+			else
+				info.mapping_config[i].submaps = 1;
 			
-			if (info.vorbis_residue_types[i] == 0 || info.vorbis_residue_types[i] == 1 || info.vorbis_residue_types[i] == 2) {
-				// "Bandpass" begin
-				info.residue_config[i].begin = readbits(24);
-				
-				// "Bandpass" end
-				info.residue_config[i].end = readbits(24);
-				
-				// Partition size
-				info.residue_config[i].partition_size = readbits(24) + 1;
-				
-				// Classifications
-				info.residue_config[i].classifications = readbits(6) + 1;
-				
-				// Classbook
-				info.residue_config[i].classbook = readbits(8);
-				
-				// Cascade vector
-				info.residue_config[i].cascade = new int[info.residue_config[i].classifications];
-				for (int j=0; j<info.residue_config[i].classifications; j++) {
-					int high_bits = 0;
-					int low_bits = readbits(3);
-					int bitflag = readbits(1);
+			// Magnitude and angle vectors
+			if (readbits(1) == 1) {
+				info.mapping_config[i].coupling_steps = readbits(8) + 1;
+				info.mapping_config[i].magnitude = new int[info.mapping_config[i].coupling_steps];
+				info.mapping_config[i].angle = new int[info.mapping_config[i].coupling_steps];
+				for (int j=0; j<info.mapping_config[i].coupling_steps; j++) {
+					info.mapping_config[i].magnitude[j] = readbits(ilog(info.audio_channels - 1));
+					info.mapping_config[i].angle[j] = readbits(ilog(info.audio_channels - 1));
 					
-					if (bitflag == 1)
-						high_bits = readbits(5);
+					// Errors
+					if (info.mapping_config[i].magnitude[j] == info.mapping_config[i].angle[j]) {
+						fail(VORBIS_ERR_SETUP, "Mapping magnitude and angle channels are identical");
+						return;
+					}
 					
-					info.residue_config[i].cascade[j] = high_bits * 8 + low_bits;
-				}
-				
-				// Book numbers
-				info.residue_config[i].books = new int*[info.residue_config[i].classifications];
-				for (int j=0; j<info.residue_config[i].classifications; j++) {
-					info.residue_config[i].books[j] = new int[8];
-					for (int k=0; k<8; k++) {
-						// If bit k of cascade[j] is set
-						if (((info.residue_config[i].cascade[j] >> k) & 0x01) == 1) {
-							info.residue_config[i].books[j][k] = readbits(8);
-							if (info.residue_config[i].books[j][k] > info.vorbis_codebook_count) {
-								cout << "Error: Residue book greater than valid codebook" << endl;
-								exit(1);
-							}
-						}
-						else
-							info.residue_config[i].books[j][k] = -1;
+					if (info.mapping_config[i].magnitude[j] >= info.audio_channels) {
+						fail(VORBIS_ERR_SETUP, "Mapping magnitude greater than valid audio channel");
+						return;
+					}
+					
+					if (info.mapping_config[i].angle[j] >= info.audio_channels) {
+						fail(VORBIS_ERR_SETUP, "Mapping angle greater than valid audio channel");
+						return;
 					}
 				}
 			} else {
-				cout << "Error: Invalid residue type" << endl;
-				exit(1);
+				info.mapping_config[i].coupling_steps = 0;
 			}
-		}
-	}
-	
-	/**
-	 * Unpack mappings
-	 */
-	void unpack_mappings() {
-		// Mapping count
-		info.vorbis_mapping_count = readbits(6) + 1;
-		
-		info.mapping_config = new Mapping[info.vorbis_mapping_count];
-		for (int i=0; i<info.vorbis_mapping_count; i++) {
-			int mapping_type = readbits(16);
-			if (mapping_type == 0) {
-				// Submaps
-				if (readbits(1) == 1)
-					info.mapping_config[i].submaps = readbits(4) + 1;
-				else
-					info.mapping_config[i].submaps = 1;
-				
-				// Magnitude and angle vectors
-				if (readbits(1) == 1) {
-					info.mapping_config[i].coupling_steps = readbits(8) + 1;
-					info.mapping_config[i].magnitude = new int[info.mapping_config[i].coupling_steps];
-					info.mapping_config[i].angle = new int[info.mapping_config[i].coupling_steps];
-					for (int j=0; j<info.mapping_config[i].coupling_steps; j++) {
-						info.mapping_config[i].magnitude[j] = readbits(ilog(info.audio_channels - 1));
-						info.mapping_config[i].angle[j] = readbits(ilog(info.audio_channels - 1));
-						
-						// Errors
-						if (info.mapping_config[i].magnitude[j] == info.mapping_config[i].angle[j]) {
-							cout << "Error: Mapping magnitude and angle channels are identical" << endl;
-							exit(1);
-						}
-						
-						if (info.mapping_config[i].magnitude[j] >= info.audio_channels) {
-							cout << "Error: Mapping magnitude greater than valid audio channel" << endl;
-							exit(1);
-						}
-						
-						if (info.mapping_config[i].angle[j] >= info.audio_channels) {
-							cout << "Error: Mapping angle greater than valid audio channel" << endl;
-							exit(1);
-						}
+			
+			// Reserved field
+			if (readbits(2) != 0) {
+				fail(VORBIS_ERR_SETUP, "Nonzero reserved mapping field");
+				return;
+			}
+			
+			// Channel multiplex settings
+			info.mapping_config[i].mux = new int[info.audio_channels];
+			if (info.mapping_config[i].submaps > 1) {
+				for (int j=0; j<info.audio_channels; j++) {
+					info.mapping_config[i].mux[j] = readbits(4);
+					if (info.mapping_config[i].mux[j] >= info.mapping_config[i].submaps) {
+						fail(VORBIS_ERR_SETUP, "Mapping mux greater than valid submap");
+						return;
 					}
-				} else {
-					info.mapping_config[i].coupling_steps = 0;
-				}
-				
-				// Reserved field
-				if (readbits(2) != 0) {
-					cout << "Error: Nonzero reserved mapping field" << endl;
-					exit(1);
 				}
+			} else {
+				for (int j=0; j<info.audio_channels; j++)
+					info.mapping_config[i].mux[j] = 0;
+			}
+			
+			info.mapping_config[i].submap_floor = new int[info.mapping_config[i].submaps];
+			info.mapping_config[i].submap_residue = new int[info.mapping_config[i].submaps];
+			for (int j=0; j<info.mapping_config[i].submaps; j++) {
+				// Unused time configuration placeholder
+				readbits(8);
 				
-				// Channel multiplex settings
-				info.mapping_config[i].mux = new int[info.audio_channels];
-				if (info.mapping_config[i].submaps > 1) {
-					for (int j=0; j<info.audio_channels; j++) {
-						info.mapping_config[i].mux[j] = readbits(4);
-						if (info.mapping_config[i].mux[j] >= info.mapping_config[i].submaps) {
-							cout << "Error: Mapping mux greater than valid submap" << endl;
-							exit(1);
-						}
-					}
-				} else {
-					for (int j=0; j<info.audio_channels; j++)
-						info.mapping_config[i].mux[j] = 0;
+				// Submap floor
+				info.mapping_config[i].submap_floor[j] = readbits(8);
+				if (info.mapping_config[i].submap_floor[j] >= info.vorbis_floor_count) {
+					fail(VORBIS_ERR_SETUP, "Mapping submap floor greater than valid floor");
+					return;
 				}
 				
-				info.mapping_config[i].submap_floor = new int[info.mapping_config[i].submaps];
-				info.mapping_config[i].submap_residue = new int[info.mapping_config[i].submaps];
-				for (int j=0; j<info.mapping_config[i].submaps; j++) {
-					// Unused time configuration placeholder
-					readbits(8);
-					
-					// Submap floor
-					info.mapping_config[i].submap_floor[j] = readbits(8);
-					if (info.mapping_config[i].submap_floor[j] >= info.vorbis_floor_count) {
-						cout << "Error: Mapping submap floor greater than valid floor" << endl;
-						exit(1);
-					}
-					
-					// Submap residue
-					info.mapping_config[i].submap_residue[j] = readbits(8);
-					if (info.mapping_config[i].submap_residue[j] >= info.vorbis_residue_count) {
-						cout << "Error: Mapping submap residue greater than valid residue" << endl;
-						exit(1);
-					}
+				// Submap residue
+				info.mapping_config[i].submap_residue[j] = readbits(8);
+				if (info.mapping_config[i].submap_residue[j] >= info.vorbis_residue_count) {
+					fail(VORBIS_ERR_SETUP, "Mapping submap residue greater than valid residue");
+					return;
 				}
-			} else {
-				cout << "Error: Invalid mapping type" << endl;
-				exit(1);
 			}
+		} else {
+			fail(VORBIS_ERR_SETUP, "Invalid mapping type");
+			return;
 		}
 	}
+}
+
+void VorbisDecoder::unpack_modes() {
+	info.vorbis_mode_count = readbits(6) + 1;
 	
-	/**
-	 * Unpack modes
-	 */
-	void unpack_modes() {
-		info.vorbis_mode_count = readbits(6) + 1;
+	info.mode_config = new Mode[info.vorbis_mode_count];
+	for (int i=0; i<info.vorbis_mode_count; i++) {
+		// Block flag
+		info.mode_config[i].blockflag = readbits(1);
+		
+		// Window type
+		info.mode_config[i].windowtype = readbits(16);
+		if (info.mode_config[i].windowtype != 0) {
+			fail(VORBIS_ERR_SETUP, "Nonzero mode window type");
+			return;
+		}
 		
-		info.mode_config = new Mode[info.vorbis_mode_count];
-		for (int i=0; i<info.vorbis_mode_count; i++) {
-			// Block flag
-			info.mode_config[i].blockflag = readbits(1);
-			
-			// Window type
-			info.mode_config[i].windowtype = readbits(16);
-			if (info.mode_config[i].windowtype != 0) {
-				cout << "Error: Nonzero mode window type" << endl;
-				exit(1);
-			}
-			
-			// Transform type
-			info.mode_config[i].transformtype = readbits(16);
-			if (info.mode_config[i].transformtype != 0) {
-				cout << "Error: Nonzero mdoe transform type" << endl;
-				exit(1);
-			}
-			
-			// Mode mapping
-			info.mode_config[i].mode_mapping = readbits(8);
-			if (info.mode_config[i].mode_mapping >= info.vorbis_mapping_count) {
-				cout << "Error: Mode mapping greater than valid mapping" << endl;
-				exit(1);
-			}
+		// Transform type
+		info.mode_config[i].transformtype = readbits(16);
+		if (info.mode_config[i].transformtype != 0) {
+			fail(VORBIS_ERR_SETUP, "Nonzero mdoe transform type");
+			return;
 		}
 		
-		int framing_flag = readbits(1);
-		if (framing_flag != 1) {
-			cout << "Error: Framing error at end of setup header" << endl;
-			exit(1);
+		// Mode mapping
+		info.mode_config[i].mode_mapping = readbits(8);
+		if (info.mode_config[i].mode_mapping >= info.vorbis_mapping_count) {
+			fail(VORBIS_ERR_SETUP, "Mode mapping greater than valid mapping");
+			return;
 		}
 	}
 	
-	/**
-	 * Reads values in from the Vorbis setup header packet
-	 */
-	void read_vorbis_setup_header() {
-		// Packet type
-		int packet_type = readbits(8);
-		if (packet_type != 0x05) {
-			cout << "Error: Not a Vorbis setup header" << endl;
-			exit(1);
-		}
-		
-		// Magic capture pattern "vorbis"
-		int vor = readbits(24);
-		int bis = readbits(24);
-		if (vor != 0x00726f76 && bis != 0x00736962) {
-			cout << "Error: Magic capture pattern \"vorbis\" not found" << endl;
-			exit(1);
+	int framing_flag = readbits(1);
+	if (framing_flag != 1) {
+		fail(VORBIS_ERR_SETUP, "Framing error at end of setup header");
+		return;
+	}
+}
+
+void VorbisDecoder::read_vorbis_setup_header() {
+	// Chained streams usually repeat the same setup header: if this one
+	// is byte-identical to the last, keep the codebooks already unpacked
+	assemble_packet();
+	if (status != VORBIS_OK)
+		return;
+	if (setup_packet != NULL && setup_packet_length == page.packet.length && setup_channels == info.audio_channels) {
+		bool same = true;
+		for (int i=0; i<setup_packet_length && same; i++)
+			same = (setup_packet[i] == page.packet.data[i]);
+		if (same) {
+			if (debug) cout << "Setup header unchanged; reusing codebooks" << endl;
+			return;
 		}
-		
-		unpack_codebooks();
+	}
+	free_setup();
+	delete [] setup_packet;
+	setup_packet = NULL;
+	
+	// Packet type
+	int packet_type = readbits(8);
+	if (packet_type != 0x05) {
+		fail(VORBIS_ERR_HEADER, "Not a Vorbis setup header");
+		return;
+	}
+	
+	// Magic capture pattern "vorbis"
+	int vor = readbits(24);
+	int bis = readbits(24);
+	if (vor != 0x00726f76 && bis != 0x00736962) {
+		fail(VORBIS_ERR_HEADER, "Magic capture pattern \"vorbis\" not found");
+		return;
+	}
+	
+	unpack_codebooks();
+	if (status == VORBIS_OK)
 		unpack_time_domain_transforms();
+	if (status == VORBIS_OK)
 		unpack_floors();
+	if (status == VORBIS_OK)
 		unpack_residues();
+	if (status == VORBIS_OK)
 		unpack_mappings();
+	if (status == VORBIS_OK)
 		unpack_modes();
-	}
+	if (status != VORBIS_OK)
+		return;
+	
+	// Keep the raw header to compare the next chain link's against
+	setup_packet_length = page.packet.length;
+	setup_packet = new int[setup_packet_length];
+	for (int i=0; i<setup_packet_length; i++)
+		setup_packet[i] = page.packet.data[i];
+	setup_channels = info.audio_channels;
+}
+
+int VorbisDecoder::decode_codebook_scalar(int book) {
+	STATS_ADD(huffman_decodes, 1);
+	HuffmanNode *node = info.codebook_config[book].htree->root;
 	
-	/**
-	 * Read bits in and find the entry corresponding to the bit pattern
-	 * @param book The codebook to search
-	 * @return The entry corresponding to the first recognized bit pattern
-	 */
-	int decode_codebook_scalar(int book) {
-		HuffmanNode *node = info.codebook_config[book].htree->root;
+	while (node->entry == -1) {
+		// Descend accordingly
+		if (readbits(1) == 0)
+			node = node->lchild;
+		else
+			node = node->rchild;
 		
-		while (node->entry == -1) {
-			// Descend accordingly
-			if (readbits(1) == 0)
-				node = node->lchild;
-			else
-				node = node->rchild;
-			
-			// We should never encounter a NULL node
-			if (node == NULL) {
-				cout << "Error: NULL node encountered while decoding bit pattern using codebook" << endl;
-				exit(1);
-			}
+		// We should never encounter a NULL node
+		if (node == NULL) {
+			fail(VORBIS_ERR_PACKET, "NULL node encountered while decoding bit pattern using codebook");
+			return 0;
 		}
+	}
+	
+	return node->entry;
+}
+
+void VorbisDecoder::skip_codebook_VQ(int book, int count) {
+	for (int i=0; i<count; i++)
+		decode_codebook_scalar(book);
+}
+
+double *VorbisDecoder::decode_codebook_VQ(int book) {
+	STATS_ADD(vq_lookups, 1);
+	int lookup_offset = decode_codebook_scalar(book);
+	double last = 0;
+	int index_divisor = 1;
+	
+	Codebook *codebook = &info.codebook_config[book];
+	
+	int multiplicand_offset;
+	if (codebook->lookup_type == 2)
+		multiplicand_offset = lookup_offset * codebook->dimensions;
+	
+	double *value_vector = new double[codebook->dimensions];
+	for (int i=0; i<codebook->dimensions; i++) {
+		if (codebook->lookup_type == 1)
+			multiplicand_offset = (lookup_offset / index_divisor) % codebook->lookup_values;
 		
-		return node->entry;
-	}
-	
-	/**
-	 * Decodes a vector from the bitstream
-	 * @param book The codebook to use
-	 * @return A vector of the constructed values
-	 */
-	double *decode_codebook_VQ(int book) {
-		int lookup_offset = decode_codebook_scalar(book);
-		double last = 0;
-		int index_divisor = 1;
+		value_vector[i] = codebook->multiplicands[multiplicand_offset] * codebook->delta_value + codebook->minimum_value + last;
 		
-		Codebook *codebook = &info.codebook_config[book];
+		if (codebook->sequence_p == 1)
+			last = value_vector[i];
 		
-		int multiplicand_offset;
 		if (codebook->lookup_type == 2)
-			multiplicand_offset = lookup_offset * codebook->dimensions;
-		
-		double *value_vector = new double[codebook->dimensions];
-		for (int i=0; i<codebook->dimensions; i++) {
-			if (codebook->lookup_type == 1)
-				multiplicand_offset = (lookup_offset / index_divisor) % codebook->lookup_values;
-			
-			value_vector[i] = codebook->multiplicands[multiplicand_offset] * codebook->delta_value + codebook->minimum_value + last;
-			
-			if (codebook->sequence_p == 1)
-				last = value_vector[i];
-			
-			if (codebook->lookup_type == 2)
-				multiplicand_offset++;
-			else
-				index_divisor *= codebook->lookup_values;
-		}
-		
-		return value_vector;
-	}
-	
-	/**
-	 * Finds the position n in vector [v] of the greatest value scalar element for which
-	 * n is less than [x] and vector [v] element n is less than vector [v] element [x]
-	 * @param v The vector to search
-	 * @param x The position to compare to
-	 * @return The low neighbor position
-	 */
-	int low_neighbor(int *v, int x) {
-		int max_value = v[0];
-		int n = 0;
-		for (int i=0; i<x; i++) {
-			if (v[i] > max_value && v[i] < v[x]) {
-				max_value = v[i];
-				n = i;
-			}
-		}
-		
-		return n;
-	}
-	
-	/**
-	 * Finds the position n in vector [v] of the lowest value scalar element for which n
-	 * is less than [x] and vector [v] element n is greater than vector [v] element [x]
-	 * @param v The vector to search
-	 * @param x The position to compare to
-	 * @return The high neighbor position
-	 */
-	int high_neighbor(int *v, int x) {
-		int min_value = v[1];
-		int n = 1;
-		for (int i=0; i<x; i++) {
-			if (v[i] < min_value && v[i] > v[x]) {
-				min_value = v[i];
-				n = i;
-			}
-		}
-		
-		return n;
-	}
-	
-	/**
-	 * Finds the Y value at point X along the line specified by x0, x1, y0 and y1; this function
-	 * uses an integer algorithm to solve for the point directly without calculating intervening
-	 * values along the line.
-	 * @param x0
-	 * @param y0
-	 * @param x1
-	 * @param y1
-	 * @param X
-	 * @return 
-	 */
-	int render_point(int x0, int y0, int x1, int y1, int X) {
-		int dy = y1 - y0;
-		int adx = x1 - x0;
-		int ady = dy;
-		if (ady < 0)
-			ady *= -1;
-		int err = ady * (X - x0);
-		int off = err / adx;
-		
-		int Y;
-		if (dy < 0)
-			Y = y0 - off;
-		else
-			Y = y0 + off;
-		
-		return Y;
-	}
-	
-	void render_line(int x0, int y0, int x1, int y1, int* v) {
-		int dy = y1 - y0;
-		int adx = x1 - x0;
-		int ady = dy;
-		if (ady < 0)
-			ady *= -1;
-		int base = dy / adx;
-		int x = x0;
-		int y = y0;
-		int err = 0;
-		
-		int sy;
-		if (dy < 0)
-			sy = base - 1;
+			multiplicand_offset++;
 		else
-			sy = base + 1;
-		
-		int abase = base;
-		if (abase < 0)
-			abase *=-1;
-		ady -= abase * adx;
-		v[x] = y;
-		
-		for (++x; x<x1; x++) {
-			err += ady;
-			if (err >= adx) {
-				err -= adx;
-				y += sy;
-			} else
-				y += base;
-				v[x] = y;
+			index_divisor *= codebook->lookup_values;
+	}
+	
+	return value_vector;
+}
+
+int VorbisDecoder::low_neighbor(int *v, int x) {
+	int max_value = v[0];
+	int n = 0;
+	for (int i=0; i<x; i++) {
+		if (v[i] > max_value && v[i] < v[x]) {
+			max_value = v[i];
+			n = i;
 		}
 	}
 	
-	/**
-	 * Floor decode and synthesis
-	 */
-	void decode_floors() {
-		audio.no_residue = new int[info.audio_channels];
-		
-		audio.floor_out = new double*[info.audio_channels];
-		for (int i=0; i<info.audio_channels; i++) {
-			int submap_number = audio.mapping->mux[i];
-			int floor_number = audio.mapping->submap_floor[submap_number];
-			Floor1 *floor1 = &info.floor_config[floor_number];
-			
-			if (info.vorbis_floor_types[floor_number] == 0) {
-				cout << "Error: Floor type 0 unsupported" << endl;
-				exit(1);
-			} else if (info.vorbis_floor_types[floor_number] == 1) {
-				int nonzero = readbits(1);
-				if (nonzero == 0) {
-					// There's no audio energy in this frame for this channel
-					audio.no_residue[i] = 1;
-					
-					// Even so, we need a zero'd floor vector
-					audio.floor_out[i] = new double[audio.n / 2];
-					for (int j=0; j<audio.n/2; j++)
-						audio.floor_out[i][j] = 0;
-				} else {
-					audio.no_residue[i] = 0;
+	return n;
+}
+
+int VorbisDecoder::high_neighbor(int *v, int x) {
+	int min_value = v[1];
+	int n = 1;
+	for (int i=0; i<x; i++) {
+		if (v[i] < min_value && v[i] > v[x]) {
+			min_value = v[i];
+			n = i;
+		}
+	}
+	
+	return n;
+}
+
+int VorbisDecoder::render_point(int x0, int y0, int x1, int y1, int X) {
+	int dy = y1 - y0;
+	int adx = x1 - x0;
+	int ady = dy;
+	if (ady < 0)
+		ady *= -1;
+	int err = ady * (X - x0);
+	int off = err / adx;
+	
+	int Y;
+	if (dy < 0)
+		Y = y0 - off;
+	else
+		Y = y0 + off;
+	
+	return Y;
+}
+
+void VorbisDecoder::render_line(int x0, int y0, int x1, int y1, int* v) {
+	int dy = y1 - y0;
+	int adx = x1 - x0;
+	int ady = dy;
+	if (ady < 0)
+		ady *= -1;
+	int base = dy / adx;
+	int x = x0;
+	int y = y0;
+	int err = 0;
+	
+	int sy;
+	if (dy < 0)
+		sy = base - 1;
+	else
+		sy = base + 1;
+	
+	int abase = base;
+	if (abase < 0)
+		abase *=-1;
+	ady -= abase * adx;
+	v[x] = y;
+	
+	for (++x; x<x1; x++) {
+		err += ady;
+		if (err >= adx) {
+			err -= adx;
+			y += sy;
+		} else
+			y += base;
+			v[x] = y;
+	}
+}
+
+void VorbisDecoder::decode_floors() {
+	audio.no_residue = new int[info.audio_channels];
+	audio.silent = new int[info.audio_channels];
+	audio.silent_frame = true;
+	
+	audio.floor_out = new double*[info.audio_channels]();
+	for (int i=0; i<info.audio_channels; i++) {
+		int submap_number = audio.mapping->mux[i];
+		int floor_number = audio.mapping->submap_floor[submap_number];
+		Floor1 *floor1 = &info.floor_config[floor_number];
+		
+		if (info.vorbis_floor_types[floor_number] == 0) {
+			fail(VORBIS_ERR_PACKET, "Floor type 0 unsupported");
+			return;
+		} else if (info.vorbis_floor_types[floor_number] == 1) {
+			int nonzero = readbits(1);
+			if (nonzero == 0) {
+				// There's no audio energy in this frame for this channel; its
+				// spectrum is all zero no matter what residue is coupled into it
+				audio.no_residue[i] = 1;
+				audio.silent[i] = 1;
+				audio.floor_out[i] = NULL;
+			} else {
+				audio.no_residue[i] = 0;
+				audio.silent[i] = 0;
+				audio.silent_frame = false;
+				
+				// Range
+				int rangev[] = {256, 128, 86, 64};
+				int range = rangev[floor1->multiplier-1];
+				
+				// Populate Y values
+				int *floor1_Y = new int[floor1->floor1_values];
+				floor1_Y[0] = readbits(ilog(range-1));
+				floor1_Y[1] = readbits(ilog(range-1));
+				int offset = 2;
+				for (int j=0; j<floor1->partitions; j++) {
+					int clas = floor1->partition_class_list[j];
+					int cdim = floor1->class_dimensions[clas];
+					int cbits = floor1->class_subclasses[clas];
+					int csub = (1 << cbits) - 1;
 					
-					// Range
-					int rangev[] = {256, 128, 86, 64};
-					int range = rangev[floor1->multiplier-1];
+					int cval = 0;
+					if (cbits > 0)
+						cval = decode_codebook_scalar(floor1->class_masterbooks[clas]);
 					
-					// Populate Y values
-					int *floor1_Y = new int[floor1->floor1_values];
-					floor1_Y[0] = readbits(ilog(range-1));
-					floor1_Y[1] = readbits(ilog(range-1));
-					int offset = 2;
-					for (int j=0; j<floor1->partitions; j++) {
-						int clas = floor1->partition_class_list[j];
-						int cdim = floor1->class_dimensions[clas];
-						int cbits = floor1->class_subclasses[clas];
-						int csub = (1 << cbits) - 1;
-						
-						int cval = 0;
-						if (cbits > 0)
-							cval = decode_codebook_scalar(floor1->class_masterbooks[clas]);
-						
-						for (int k=0; k<cdim; k++) {
-							int book = floor1->subclass_books[clas][cval&csub];
-							cval >>= cbits;
-							if (book >= 0)
-								floor1_Y[k+offset] = decode_codebook_scalar(book);
-							else
-								floor1_Y[k+offset] = 0;
-						}
-						offset += cdim;
+					for (int k=0; k<cdim; k++) {
+						int book = floor1->subclass_books[clas][cval&csub];
+						cval >>= cbits;
+						if (book >= 0)
+							floor1_Y[k+offset] = decode_codebook_scalar(book);
+						else
+							floor1_Y[k+offset] = 0;
 					}
+					offset += cdim;
+				}
+				
+				// Amplitude value synthesis
+				int *floor1_step2_flag = new int[floor1->floor1_values];
+				floor1_step2_flag[0] = 1;
+				floor1_step2_flag[1] = 1;
+				int *floor1_final_Y = new int[floor1->floor1_values];
+				floor1_final_Y[0] = floor1_Y[0];
+				floor1_final_Y[1] = floor1_Y[1];
+				for (int j=2; j<floor1->floor1_values; j++) {
+					int low_neighbor_offset = low_neighbor(floor1->X_list, j);
+					int high_neighbor_offset = high_neighbor(floor1->X_list, j);
+					int predicted = render_point(floor1->X_list[low_neighbor_offset], 
+							floor1_final_Y[low_neighbor_offset],
+							floor1->X_list[high_neighbor_offset],
+							floor1_final_Y[high_neighbor_offset],
+							floor1->X_list[j]);
+					int val = floor1_Y[j];
+					int highroom = range - predicted;
+					int lowroom = predicted;
+					int room;
+					if (highroom < lowroom)
+						room = highroom * 2;
+					else
+						room = lowroom * 2;
 					
-					// Amplitude value synthesis
-					int *floor1_step2_flag = new int[floor1->floor1_values];
-					floor1_step2_flag[0] = 1;
-					floor1_step2_flag[1] = 1;
-					int *floor1_final_Y = new int[floor1->floor1_values];
-					floor1_final_Y[0] = floor1_Y[0];
-					floor1_final_Y[1] = floor1_Y[1];
-					for (int j=2; j<floor1->floor1_values; j++) {
-						int low_neighbor_offset = low_neighbor(floor1->X_list, j);
-						int high_neighbor_offset = high_neighbor(floor1->X_list, j);
-						int predicted = render_point(floor1->X_list[low_neighbor_offset], 
-								floor1_final_Y[low_neighbor_offset],
-								floor1->X_list[high_neighbor_offset],
-								floor1_final_Y[high_neighbor_offset],
-								floor1->X_list[j]);
-						int val = floor1_Y[j];
-						int highroom = range - predicted;
-						int lowroom = predicted;
-						int room;
-						if (highroom < lowroom)
-							room = highroom * 2;
-						else
-							room = lowroom * 2;
+					if (val != 0) {
+						floor1_step2_flag[low_neighbor_offset] = 1;
+						floor1_step2_flag[high_neighbor_offset] = 1;
+						floor1_step2_flag[j] = 1;
 						
-						if (val != 0) {
-							floor1_step2_flag[low_neighbor_offset] = 1;
-							floor1_step2_flag[high_neighbor_offset] = 1;
-							floor1_step2_flag[j] = 1;
-							
-							if (val >= room) {
-								if (highroom > lowroom)
-									floor1_final_Y[j] = val - lowroom + predicted;
-								else
-									floor1_final_Y[j] = predicted - val + highroom - 1;
-							} else {
-								if ((val&0x01) == 1)
-									floor1_final_Y[j] = predicted - ((val+1) / 2);
-								else
-									floor1_final_Y[j] = predicted + val/2;
-							}
+						if (val >= room) {
+							if (highroom > lowroom)
+								floor1_final_Y[j] = val - lowroom + predicted;
+							else
+								floor1_final_Y[j] = predicted - val + highroom - 1;
 						} else {
-							floor1_step2_flag[j] = 0;
-							floor1_final_Y[j] = predicted;
-						}
-					}
-					
-					// Sort the three vectors according to ascending X_list
-					int *X_list_sort = new int[floor1->floor1_values];
-					for (int j=0; j<floor1->floor1_values; j++)
-						X_list_sort[j] = floor1->X_list[j];
-					for (int j=0; j<floor1->floor1_values; j++) { // This is a vvvvveeeeerrrrryyyyy slow sort
-						int min_value = X_list_sort[j];
-						int min_pos = j;
-						for (int k=j; k<floor1->floor1_values; k++) {
-							if (X_list_sort[k] < min_value) {
-								min_value = X_list_sort[k];
-								min_pos = k;
-							}
+							if ((val&0x01) == 1)
+								floor1_final_Y[j] = predicted - ((val+1) / 2);
+							else
+								floor1_final_Y[j] = predicted + val/2;
 						}
-						
-						int tmp = X_list_sort[min_pos];
-						X_list_sort[min_pos] = X_list_sort[j];
-						X_list_sort[j] = tmp;
-						
-						tmp = floor1_final_Y[min_pos];
-						floor1_final_Y[min_pos] = floor1_final_Y[j];
-						floor1_final_Y[j] = tmp;
-						
-						tmp = floor1_step2_flag[min_pos];
-						floor1_step2_flag[min_pos] = floor1_step2_flag[j];
-						floor1_step2_flag[j] = tmp;
+					} else {
+						floor1_step2_flag[j] = 0;
+						floor1_final_Y[j] = predicted;
 					}
-					
-					// Curve synthesis
-					int *floor_out_int = new int[audio.n / 2];
-					int hx = 0;
-					int hy = 0;
-					int lx = 0;
-					int ly = floor1_final_Y[0] * floor1->multiplier;
-					for (int j=1; j<floor1->floor1_values; j++) {
-						if (floor1_step2_flag[j] == 1) {
-							hy = floor1_final_Y[j] * floor1->multiplier;
-							hx = X_list_sort[j];
-							render_line(lx, ly, hx, hy, floor_out_int);
-							lx = hx;
-							ly = hy;
+				}
+				
+				// Sort the three vectors according to ascending X_list
+				int *X_list_sort = new int[floor1->floor1_values];
+				for (int j=0; j<floor1->floor1_values; j++)
+					X_list_sort[j] = floor1->X_list[j];
+				for (int j=0; j<floor1->floor1_values; j++) { // This is a vvvvveeeeerrrrryyyyy slow sort
+					int min_value = X_list_sort[j];
+					int min_pos = j;
+					for (int k=j; k<floor1->floor1_values; k++) {
+						if (X_list_sort[k] < min_value) {
+							min_value = X_list_sort[k];
+							min_pos = k;
 						}
 					}
 					
-					if (hx < audio.n / 2)
-						render_line(hx, hy, audio.n / 2, hy, floor_out_int);
-					if (hx > audio.n / 2)
-						if (warning) cout << "Warning: hx > n / 2; floor_out should be truncated" << endl;
+					int tmp = X_list_sort[min_pos];
+					X_list_sort[min_pos] = X_list_sort[j];
+					X_list_sort[j] = tmp;
 					
-					audio.floor_out[i] = new double[audio.n / 2];
-					for (int j=0; j<audio.n/2; j++)
-						audio.floor_out[i][j] = floor1_inverse_dB_table[floor_out_int[j]];
+					tmp = floor1_final_Y[min_pos];
+					floor1_final_Y[min_pos] = floor1_final_Y[j];
+					floor1_final_Y[j] = tmp;
 					
-					// Cleanup
-					delete floor_out_int;
-					delete X_list_sort;
-					delete floor1_final_Y;
-					delete floor1_step2_flag;
-					delete floor1_Y;
+					tmp = floor1_step2_flag[min_pos];
+					floor1_step2_flag[min_pos] = floor1_step2_flag[j];
+					floor1_step2_flag[j] = tmp;
+				}
+				
+				// Curve synthesis
+				int *floor_out_int = new int[audio.n / 2];
+				int hx = 0;
+				int hy = 0;
+				int lx = 0;
+				int ly = floor1_final_Y[0] * floor1->multiplier;
+				for (int j=1; j<floor1->floor1_values; j++) {
+					if (floor1_step2_flag[j] == 1) {
+						hy = floor1_final_Y[j] * floor1->multiplier;
+						hx = X_list_sort[j];
+						if (lx < audio.spectrum_limit)
+							render_line(lx, ly, hx, hy, floor_out_int);
+						lx = hx;
+						ly = hy;
+					}
 				}
+				
+				if (hx < audio.spectrum_limit)
+					render_line(hx, hy, audio.n / 2, hy, floor_out_int);
+				if (hx > audio.n / 2)
+					if (warning) cout << "Warning: hx > n / 2; floor_out should be truncated" << endl;
+				
+				audio.floor_out[i] = new double[audio.n / 2];
+				for (int j=0; j<audio.spectrum_limit; j++)
+					audio.floor_out[i][j] = floor1_inverse_dB_table[floor_out_int[j]];
+				
+				// Cleanup
+				delete [] floor_out_int;
+				delete [] X_list_sort;
+				delete [] floor1_final_Y;
+				delete [] floor1_step2_flag;
+				delete [] floor1_Y;
 			}
 		}
 	}
+}
+
+void VorbisDecoder::decode_residues() {
+	int *do_not_decode_flag = new int[info.audio_channels];
+	for (int i=0; i<info.audio_channels; i++)
+		do_not_decode_flag[i] = 0;
 	
-	/**
-	 * Residue decode
-	 */
-	void decode_residues() {
-		int *do_not_decode_flag = new int[info.audio_channels];
-		for (int i=0; i<info.audio_channels; i++)
-			do_not_decode_flag[i] = 0;
-		
-		for (int i=0; i<audio.mapping->submaps; i++) {
-			int ch = 0;
-			for (int j=0; j<info.audio_channels; j++) {
-				if (audio.mapping->mux[j] == i) {
-					if (audio.no_residue[j] == 1)
-						do_not_decode_flag[ch] = 1;
-					else
-						do_not_decode_flag[ch] = 0;
-					ch++;
-				}
+	audio.residue_out = new double*[info.audio_channels];
+	
+	for (int i=0; i<audio.mapping->submaps; i++)
+		decode_submap_residue(i, do_not_decode_flag);
+	
+	delete [] do_not_decode_flag;
+}
+
+void VorbisDecoder::decode_submap_residue(int submap, int *do_not_decode_flag) {
+	int ch = 0;
+	for (int j=0; j<info.audio_channels; j++) {
+		if (audio.mapping->mux[j] == submap) {
+			if (audio.no_residue[j] == 1)
+				do_not_decode_flag[ch] = 1;
+			else
+				do_not_decode_flag[ch] = 0;
+			ch++;
+		}
+	}
+	
+	int residue_number = audio.mapping->submap_residue[submap];
+	int residue_type = info.vorbis_residue_types[residue_number];
+	STATS_ADD(residue_types[residue_type], 1);
+	Residue *residue = &info.residue_config[residue_number];
+	
+	// Limit residue sizes; a type 2 residue interleaves only this
+	// submap's channels, which need not be all of the stream's
+	int submap_channels = ch;
+	int actual_size = audio.n / 2;
+	if (residue_type == 2) {
+		actual_size *= ch;
+		ch = 1;
+	}
+	int limit_residue_begin = residue->begin;
+	int limit_residue_end;
+	if (residue->end < actual_size)
+		limit_residue_end = residue->end;
+	else
+		limit_residue_end = actual_size;
+	
+	// Band limit: partitions starting at or past this point are read
+	// from the bitstream but never reconstructed
+	int limit_residue_band = audio.spectrum_limit;
+	if (residue_type == 2)
+		limit_residue_band *= submap_channels;
+	
+	// Nothing follows the last submap's residue in the packet, so its
+	// final coded pass can stop at the band limit altogether
+	int last_pass = -1;
+	if (submap == audio.mapping->submaps - 1 && limit_residue_band < limit_residue_end) {
+		for (int j=0; j<residue->classifications; j++) {
+			for (int k=0; k<8; k++) {
+				if (residue->books[j][k] != -1 && k > last_pass)
+					last_pass = k;
 			}
-			
-			int residue_number = audio.mapping->submap_residue[i];
-			int residue_type = info.vorbis_residue_types[residue_number];
-			Residue *residue = &info.residue_config[residue_number];
-			
-			// Limit residue sizes
-			int actual_size = audio.n / 2;
-			if (residue_type == 2) {
-				actual_size *= ch;
-				ch = 1;
+		}
+	}
+	
+	// Convenience values
+	int classwords_per_codeword = info.codebook_config[residue->classbook].dimensions;
+	int n_to_read = limit_residue_end - limit_residue_begin;
+	int partitions_to_read = n_to_read / residue->partition_size;
+	
+	// Allocate all returned vectors
+	double **decoded = new double*[info.audio_channels];
+	for (int j=0; j<info.audio_channels; j++) {
+		decoded[j] = new double[actual_size];
+		
+		for (int k=0; k<actual_size; k++) // Zero it
+			decoded[j][k] = 0;
+	}
+	
+	// Decode vectors
+	if (n_to_read != 0) {
+		int **classifications = new int*[ch];
+		for (int j=0; j<ch; j++) {
+			classifications[j] = new int[classwords_per_codeword + partitions_to_read];
+			for (int k=0; k<classwords_per_codeword + partitions_to_read; k++)
+				classifications[j][k] = 0;
+		}
+		
+		// Residue type 2 pre-step: is any channel to be decoded at all?
+		bool decode_interleaved = false;
+		for (int a=0; a<submap_channels; a++) {
+			if (do_not_decode_flag[a] == 0) {
+				decode_interleaved = true;
+				break;
 			}
-			int limit_residue_begin = residue->begin;
-			int limit_residue_end;
-			if (residue->end < actual_size)
-				limit_residue_end = residue->end;
-			else
-				limit_residue_end = actual_size;
-			
-			// Convenience values
-			int classwords_per_codeword = info.codebook_config[residue->classbook].dimensions;
-			int n_to_read = limit_residue_end - limit_residue_begin;
-			int partitions_to_read = n_to_read / residue->partition_size;
-			
-			// Allocate all returned vectors
-			double **decoded = new double*[info.audio_channels];
-			audio.residue_out = new double*[info.audio_channels];
-			for (int j=0; j<info.audio_channels; j++) {
-				decoded[j] = new double[actual_size];
+		}
+		if (residue_type == 2) // The interleaved vector is the one channel
+			do_not_decode_flag[0] = (decode_interleaved ? 0 : 1);
+		
+		for (int pass=0; pass<8; pass++) {
+			int partition_count = 0;
+			while (partition_count < partitions_to_read) {
+				if (pass == last_pass && limit_residue_begin + partition_count * residue->partition_size >= limit_residue_band)
+					break;
 				
-				for (int k=0; k<actual_size; k++) // Zero it
-					decoded[j][k] = 0;
-			}
-			
-			// Decode vectors
-			if (n_to_read != 0) {
-				int **classifications = new int*[ch];
-				for (int j=0; j<ch; j++) {
-					classifications[j] = new int[classwords_per_codeword + partitions_to_read];
-					for (int k=0; k<classwords_per_codeword + partitions_to_read; k++)
-						classifications[j][k] = 0;
+				if (pass == 0) {
+					for (int j=0; j<ch; j++) {
+						if (do_not_decode_flag[j] == 0) {
+							int temp = decode_codebook_scalar(residue->classbook);
+							for (int k=classwords_per_codeword-1; k>=0; k--) {
+								classifications[j][k+partition_count] = temp % residue->classifications;
+								temp /= residue->classifications;
+							}
+						}
+					}
 				}
 				
-				for (int pass=0; pass<8; pass++) {
-					int partition_count = 0;
-					while (partition_count < partitions_to_read) {
-						if (pass == 0) {
-							for (int j=0; j<ch; j++) {
-								if (do_not_decode_flag[j] == 0) {
-									int temp = decode_codebook_scalar(residue->classbook);
-									for (int k=classwords_per_codeword-1; k>=0; k--) {
-										classifications[j][k+partition_count] = temp % residue->classifications;
-										temp /= residue->classifications;
+				for (int j=0; (j<classwords_per_codeword) && (partition_count<partitions_to_read); j++) {
+					for (int k=0; k<ch; k++) {
+						if (do_not_decode_flag[k] == 0) {
+							int vqclass = classifications[k][partition_count];
+							int vqbook = residue->books[vqclass][pass];
+							if (vqbook != -1) {
+								int n = residue->partition_size;
+								int offset = limit_residue_begin + partition_count * n;
+								int dimensions = info.codebook_config[vqbook].dimensions;
+								if (offset >= limit_residue_band) {
+									// Above the band limit; consume the codewords only
+									if (residue_type == 0)
+										skip_codebook_VQ(vqbook, n / dimensions);
+									else if (residue_type == 1 || decode_interleaved)
+										skip_codebook_VQ(vqbook, (n + dimensions - 1) / dimensions);
+								} else if (residue_type == 0) {
+									int step = n / info.codebook_config[vqbook].dimensions;
+									
+									for (int l=0; l<step; l++) {
+										double *entry_temp = decode_codebook_VQ(vqbook);
+										for (int m=0; m<info.codebook_config[vqbook].dimensions; m++)
+											decoded[k][offset + l + m*step] += entry_temp[m];
+										delete [] entry_temp;
 									}
 								}
-							}
-						}
-						
-						for (int j=0; (j<classwords_per_codeword) && (partition_count<partitions_to_read); j++) {
-							for (int k=0; k<ch; k++) {
-								if (do_not_decode_flag[k] == 0) {
-									int vqclass = classifications[k][partition_count];
-									int vqbook = residue->books[vqclass][pass];
-									if (vqbook != -1) {
-										int n = residue->partition_size;
-										int offset = limit_residue_begin + partition_count * n;
-										if (residue_type == 0) {
-											int step = n / info.codebook_config[vqbook].dimensions;
-											
-											for (int l=0; l<step; l++) {
-												double *entry_temp = decode_codebook_VQ(vqbook);
-												for (int m=0; m<info.codebook_config[vqbook].dimensions; m++)
-													decoded[k][offset + l + m*step] += entry_temp[m];
-												delete entry_temp;
-											}
+								else if (residue_type == 1) {
+									int l = 0;
+									while (l < n) {
+										double *entry_temp = decode_codebook_VQ(vqbook);
+										for (int m=0; m<info.codebook_config[vqbook].dimensions; m++) {
+											decoded[k][offset + l] += entry_temp[m];
+											l++;
 										}
-										else if (residue_type == 1) {
-											int l = 0;
-											while (l < n) {
-												double *entry_temp = decode_codebook_VQ(vqbook);
-												for (int m=0; m<info.codebook_config[vqbook].dimensions; m++) {
-													decoded[k][offset + l] += entry_temp[m];
-													l++;
-												}
-												delete entry_temp;
-											}
-										} else if (residue_type == 2) {
-											// Pre-step
-											bool decode = false;
-											for (int a=0; a<info.audio_channels; a++) {
-												if (do_not_decode_flag[a] == 0) {
-													decode = true;
-													break;
-												}
-											}
-											
-											double *interleave = new double[actual_size];
-											for (int l=0; l<actual_size; l++) // Zero it
-												interleave[l] = 0;
-											
-											if (decode) {
-												// Type 1 decode
-												int l = 0;
-												while (l < n) {
-													double *entry_temp = decode_codebook_VQ(vqbook);
-													for (int m=0; m<info.codebook_config[vqbook].dimensions; m++) {
-														interleave[offset + l] += entry_temp[m];
-														l++;
-													}
-													delete entry_temp;
-												}
-											}
-											
-											// Post-step
-											for (int a=0; a<audio.n/2; a++) {
-												for (int b=0; b<info.audio_channels; b++)
-													decoded[b][a] += interleave[a*info.audio_channels + b];
+										delete [] entry_temp;
+									}
+								} else if (residue_type == 2) {
+									// Type 1 decode with the post-step deinterleave folded in;
+									// only this partition's span of the channels is touched
+									if (decode_interleaved) {
+										int l = 0;
+										while (l < n) {
+											double *entry_temp = decode_codebook_VQ(vqbook);
+											for (int m=0; m<info.codebook_config[vqbook].dimensions; m++) {
+												int pos = offset + l;
+												decoded[pos % submap_channels][pos / submap_channels] += entry_temp[m];
+												l++;
 											}
-											delete interleave;
+											delete [] entry_temp;
 										}
 									}
 								}
-								partition_count++;
 							}
 						}
 					}
-				}
-				
-				for (int j=0; j<ch; j++)
-					delete classifications[j];
-				delete classifications;
-			}
-			
-			// Correctly assign data to channels
-			ch = 0;
-			for (int j=0; j<info.audio_channels; j++) {
-				if (audio.mapping->mux[j] == i) {
-					audio.residue_out[j] = decoded[ch];
-					ch++;
+					partition_count++;
 				}
 			}
 		}
 		
-		delete do_not_decode_flag;
-	}
-	
-	/* partial; doesn't perform last-step deinterleave/unrolling.  That
-   can be done more efficiently during pcm output */
-void mdct_backward(int n, DATA_TYPE *in){
-	int shift;
-	int step;
-  
-	for (shift=4;!(n&(1<<shift));shift++);
-	shift=13-shift;
-	step=2<<shift;
-   
-	presymmetry(in,n>>1,step);
-	mdct_butterflies(in,n>>1,shift);
-	mdct_bitreverse(in,n,shift);
-	mdct_step7(in,n,step);
-	mdct_step8(in,n,step);
-}
-
-void mdct_shift_right(int n, DATA_TYPE *in, DATA_TYPE *right){
-	int i;
-	n>>=2;
-	in+=1;
-
-	for(i=0;i<n;i++)
-		right[i]=in[i<<1];
-}
-
-void mdct_unroll_lap(int n0,int n1,
-						int lW,int W,
-						DATA_TYPE *in,
-						DATA_TYPE *right,
-						LOOKUP_T *w0,
-						LOOKUP_T *w1,
-						ogg_int16_t *out,
-						int step,
-						int start, /* samples, this frame */
-						int end    /* samples, this frame */) {
-
-	   DATA_TYPE *l=in+(W&&lW ? n1>>1 : n0>>1);
-	   DATA_TYPE *r=right+(lW ? n1>>2 : n0>>2);
-	   DATA_TYPE *post;
-	   LOOKUP_T *wR=(W && lW ? w1+(n1>>1) : w0+(n0>>1));
-	   LOOKUP_T *wL=(W && lW ? w1         : w0        );
-
-	   int preLap=(lW && !W ? (n1>>2)-(n0>>2) : 0 );
-	   int halfLap=(lW && W ? (n1>>2) : (n0>>2) );
-	   int postLap=(!lW && W ? (n1>>2)-(n0>>2) : 0 );
-	   int n,off;
-
-	   /* preceeding direct-copy lapping from previous frame, if any */
-	   if(preLap){
-		   n      = (end<preLap?end:preLap);
-		   off    = (start<preLap?start:preLap);
-		   post   = r-n;
-		   r     -= off;
-		   start -= off;
-		   end   -= n;
-		   while(r>post){
-			   *out = CLIP_TO_15((*--r)>>9);
-			   out+=step;
-		   }
-	   }
-  
-	   /* cross-lap; two halves due to wrap-around */
-	   n      = (end<halfLap?end:halfLap);
-	   off    = (start<halfLap?start:halfLap);
-	   post   = r-n;
-	   r     -= off;
-	   l     -= off*2;
-	   start -= off;
-	   wR    -= off;
-	   wL    += off;
-	   end   -= n;
-	   while(r>post){
-		   l-=2;
-		   *out = CLIP_TO_15((MULT31(*--r,*--wR) + MULT31(*l,*wL++))>>9);
-		   out+=step;
-	   }
-
-	   n      = (end<halfLap?end:halfLap);
-	   off    = (start<halfLap?start:halfLap);
-	   post   = r+n;
-	   r     += off;
-	   l     += off*2;
-	   start -= off;
-	   end   -= n;
-	   wR    -= off;
-	   wL    += off;
-	   while(r<post){
-		   *out = CLIP_TO_15((MULT31(*r++,*--wR) - MULT31(*l,*wL++))>>9);
-		   out+=step;
-		   l+=2;
-	   }
-
-	   /* preceeding direct-copy lapping from previous frame, if any */
-	   if(postLap){
-		   n      = (end<postLap?end:postLap);
-		   off    = (start<postLap?start:postLap);
-		   post   = l+n*2;
-		   l     += off*2;
-		   while(l<post){
-			   *out = CLIP_TO_15((-*l)>>9);
-			   out+=step;
-			   l+=2;
-		   }
-	   }
-   }
-	
-	void imdct(int *in, int n) {;
-		mdct_backward(n, in);
-	}
-	
-	/**
-	 * Decode an audio packet
-	 */
-	void decode_audio() {
-		// Packet type
-		int packet_type = readbits(1);
-		if (packet_type != 0) {
-			if (warning)
-				cout << "Warning: Non-audio packet found where audio packet expected" << endl;
-		} else {
-			// Mode number
-			int mode_number = readbits(ilog(info.vorbis_mode_count - 1));
-			audio.mode = &info.mode_config[mode_number];
-			audio.mapping = &info.mapping_config[audio.mode->mode_mapping];
-			
-			if (!first_packet)
-				audio.last_n = audio.n;
-			else
-				audio.last_n = 0;
-			
-			// Decode blocksize
-			if (audio.mode->blockflag == 0)
-				audio.n = info.blocksize_0;
-			else
-				audio.n = info.blocksize_1;
-			
-			// Window selection
-			audio.previous_window_flag = 0;
-			audio.next_window_flag = 0;
-			if (audio.mode->blockflag == 1) {
-				audio.previous_window_flag = readbits(1);
-				audio.next_window_flag = readbits(1);
-			}
-			
-			// Window setup
-			audio.window_center = audio.n/2;
-			if (audio.mode->blockflag == 1 && audio.previous_window_flag == 0) {
-				audio.left_window_start = audio.n/4 - info.blocksize_0/4;
-				audio.left_window_end = audio.n/4 + info.blocksize_0/4;
-				audio.left_n = info.blocksize_0/2;
-			} else {
-				audio.left_window_start = 0;
-				audio.left_window_end = audio.window_center;
-				audio.left_n = audio.n/2;
-			}
-			
-			if (audio.mode->blockflag == 1 && audio.next_window_flag == 0) {
-				audio.right_window_start = audio.n*3/4 - info.blocksize_0/4;
-				audio.right_window_end = audio.n*3/4 + info.blocksize_0/4;
-				audio.right_n = info.blocksize_0/2;
-			} else {
-				audio.right_window_start = audio.window_center;
-				audio.right_window_end = audio.n;
-				audio.right_n = audio.n/2;
-			}
-			
-			decode_floors();
-			
-			// Nonzero vector propagate: match magnitude and angle if either one is 'unused'
-			for (int i=0; i<audio.mapping->coupling_steps; i++) {
-				int mag = audio.mapping->magnitude[i];
-				int ang = audio.mapping->angle[i];
-				if (audio.no_residue[mag] == 0 || audio.no_residue[ang] == 0) {
-					audio.no_residue[mag] = 0;
-					audio.no_residue[ang] = 0;
-				}
+		for (int j=0; j<ch; j++)
+			delete [] classifications[j];
+		delete [] classifications;
+	}
+	
+	// Correctly assign data to channels
+	ch = 0;
+	for (int j=0; j<info.audio_channels; j++) {
+		if (audio.mapping->mux[j] == submap) {
+			audio.residue_out[j] = decoded[ch];
+			ch++;
+		}
+	}
+	
+	// Vectors left over belong to no channel in this submap
+	for (int j=ch; j<info.audio_channels; j++)
+		delete [] decoded[j];
+	delete [] decoded;
+}
+
+void VorbisDecoder::nonzero_vector_propagate() {
+	for (int i=0; i<audio.mapping->coupling_steps; i++) {
+		int mag = audio.mapping->magnitude[i];
+		int ang = audio.mapping->angle[i];
+		if (audio.no_residue[mag] == 0 || audio.no_residue[ang] == 0) {
+			audio.no_residue[mag] = 0;
+			audio.no_residue[ang] = 0;
+		}
+	}
+}
+
+void VorbisDecoder::inverse_coupling() {
+	// Without a downmix, a pair that no earlier step touches again is
+	// final here, so its spectra can be written in the same pass
+	bool fuse = (downmix == NULL && status == VORBIS_OK);
+	for (int i=audio.mapping->coupling_steps-1; i>=0; i--) {
+		int mag = audio.mapping->magnitude[i];
+		int ang = audio.mapping->angle[i];
+		double *magnitude_vector = audio.residue_out[mag];
+		double *angle_vector = audio.residue_out[ang];
+		
+		bool final = fuse && audio.silent[mag] == 0 && audio.silent[ang] == 0;
+		for (int k=0; k<i && final; k++) {
+			int m = audio.mapping->magnitude[k];
+			int a = audio.mapping->angle[k];
+			if (m == mag || m == ang || a == mag || a == ang)
+				final = false;
+		}
+		
+		if (final) {
+			audio.spectrum[mag] = new_spectrum();
+			audio.spectrum[ang] = new_spectrum();
+			couple_spectra(magnitude_vector, angle_vector, audio.floor_out[mag], audio.floor_out[ang],
+				spectrum_scale, audio.spectrum[mag], audio.spectrum[ang], audio.spectrum_limit);
+		} else
+			couple_residues(magnitude_vector, angle_vector, audio.spectrum_limit);
+	}
+}
+
+int *VorbisDecoder::new_spectrum() {
+	int *spectrum = new int[audio.n/2];
+	for (int j=audio.spectrum_limit; j<audio.synthesis_n/2; j++)
+		spectrum[j] = 0;
+	return spectrum;
+}
+
+void VorbisDecoder::downmix_spectrum() {
+	double *mix = new double[audio.spectrum_limit];
+	for (int i=0; i<out_channels; i++) {
+		bool used = false;
+		for (int j=0; j<audio.spectrum_limit; j++)
+			mix[j] = 0;
+		
+		for (int c=0; c<info.audio_channels; c++) {
+			double gain = downmix[i*info.audio_channels + c];
+			if (gain == 0 || audio.silent[c] == 1)
+				continue;
+			used = true;
+			for (int j=0; j<audio.spectrum_limit; j++)
+				mix[j] += gain * audio.floor_out[c][j] * audio.residue_out[c][j];
+		}
+		
+		if (!used) {
+			audio.spectrum[i] = NULL;
+			continue;
+		}
+		
+		audio.spectrum[i] = new_spectrum();
+		for (int j=0; j<audio.spectrum_limit; j++)
+			audio.spectrum[i][j] = (int)(mix[j] * spectrum_scale);
+	}
+	delete [] mix;
+}
+
+/**
+ * mdct_unroll_lap_pcm, through the stream's limiter while it has one
+ */
+template <class PCM>
+static void unroll_limited(const lap_descriptor *lap, DATA_TYPE *in, DATA_TYPE *right, PCM &pcm, bool limiting, ogg_int32_t &gain, typename PCM::sample_t *out, int step, int start, int end) {
+	if (limiting) {
+		pcm_limit<PCM> limit(pcm, gain);
+		mdct_unroll_lap_pcm(lap, in, right, limit, out, step, start, end);
+	} else
+		mdct_unroll_lap_pcm(lap, in, right, pcm, out, step, start, end);
+}
+
+void VorbisDecoder::unroll_channel(int channel, const lap_descriptor *lap, char *out, int step, int start, int end) {
+	DATA_TYPE *in = audio.spectrum[channel];
+	DATA_TYPE *right = mdctright[channel];
+	
+	if (options.bits == 24) {
+		pcm_24 pcm;
+		unroll_limited(lap, in, right, pcm, limiting, limit_gain, (ogg_int32_t *)out, step, start, end);
+	} else if (options.bits == 32) {
+		pcm_32 pcm;
+		unroll_limited(lap, in, right, pcm, limiting, limit_gain, (ogg_int32_t *)out, step, start, end);
+	} else if (options.dither)
+		unroll_limited(lap, in, right, dither, limiting, limit_gain, (ogg_int16_t *)out, step, start, end);
+	else if (limiting) {
+		pcm_16 pcm;
+		unroll_limited(lap, in, right, pcm, limiting, limit_gain, (ogg_int16_t *)out, step, start, end);
+	} else
+		mdct_unroll_lap(lap, in, right, (ogg_int16_t *)out, step, start, end);
+}
+
+void VorbisDecoder::imdct(int *in, int n) {
+	mdct_backward(n, in);
+}
+
+void VorbisDecoder::conceal_packet() {
+	for (int i=0; i<info.audio_channels; i++) {
+		delete [] audio.floor_out[i];
+		audio.floor_out[i] = NULL;
+		audio.no_residue[i] = 1;
+		audio.silent[i] = 1;
+	}
+	audio.silent_frame = true;
+	
+	if (audio.residue_out != NULL) {
+		for (int i=0; i<info.audio_channels; i++)
+			delete [] audio.residue_out[i];
+		delete [] audio.residue_out;
+		audio.residue_out = NULL;
+	}
+}
+
+bool VorbisDecoder::read_audio_header() {
+	// Packet type
+	int packet_type = readbits(1);
+	if (packet_type != 0) {
+		if (warning)
+			cout << "Warning: Non-audio packet found where audio packet expected" << endl;
+		return false;
+	}
+	
+	// Mode number
+	int mode_number = readbits(ilog(info.vorbis_mode_count - 1));
+	if (mode_number >= info.vorbis_mode_count) {
+		// Without a mode there's no blocksize to stand silence in for
+		fail(VORBIS_ERR_PACKET, "Invalid mode number");
+		return false;
+	}
+	audio.mode = &info.mode_config[mode_number];
+	audio.mapping = &info.mapping_config[audio.mode->mode_mapping];
+	
+	if (!first_packet)
+		audio.last_n = audio.n;
+	else
+		audio.last_n = 0;
+	
+	// Decode blocksize
+	if (audio.mode->blockflag == 0)
+		audio.n = info.blocksize_0;
+	else
+		audio.n = info.blocksize_1;
+	
+	// Reduced-rate synthesis only needs the low n/decimation/2 bins
+	audio.synthesis_n = audio.n / options.decimation;
+	
+	// Spectral band limit for this blocksize; bin k sits at k*rate/n Hz
+	audio.spectrum_limit = audio.synthesis_n/2;
+	if (options.bandlimit_hz > 0) {
+		long long limit = ((long long)options.bandlimit_hz * audio.n + info.audio_sample_rate - 1) / info.audio_sample_rate;
+		if (limit < audio.spectrum_limit)
+			audio.spectrum_limit = (int)limit;
+	}
+	
+	// Window selection
+	audio.previous_window_flag = 0;
+	audio.next_window_flag = 0;
+	if (audio.mode->blockflag == 1) {
+		audio.previous_window_flag = readbits(1);
+		audio.next_window_flag = readbits(1);
+	}
+	
+	// Window setup
+	audio.window_center = audio.n/2;
+	if (audio.mode->blockflag == 1 && audio.previous_window_flag == 0) {
+		audio.left_window_start = audio.n/4 - info.blocksize_0/4;
+		audio.left_window_end = audio.n/4 + info.blocksize_0/4;
+		audio.left_n = info.blocksize_0/2;
+	} else {
+		audio.left_window_start = 0;
+		audio.left_window_end = audio.window_center;
+		audio.left_n = audio.n/2;
+	}
+	
+	if (audio.mode->blockflag == 1 && audio.next_window_flag == 0) {
+		audio.right_window_start = audio.n*3/4 - info.blocksize_0/4;
+		audio.right_window_end = audio.n*3/4 + info.blocksize_0/4;
+		audio.right_n = info.blocksize_0/2;
+	} else {
+		audio.right_window_start = audio.window_center;
+		audio.right_window_end = audio.n;
+		audio.right_n = audio.n/2;
+	}
+	
+	return true;
+}
+
+void VorbisDecoder::free_packet_vectors() {
+	for (int i=0; i<info.audio_channels; i++)
+		delete [] audio.floor_out[i];
+	delete [] audio.floor_out;
+	
+	if (audio.residue_out != NULL) {
+		for (int i=0; i<info.audio_channels; i++)
+			delete [] audio.residue_out[i];
+		delete [] audio.residue_out;
+	}
+	
+	delete [] audio.no_residue;
+	delete [] audio.silent;
+}
+
+void VorbisDecoder::decode_audio() {
+	STATS_START(t);
+	if (read_audio_header()) {
+		STATS_ADD(packets, 1);
+		STATS_ADD(blocksizes[ilog(audio.n) - 1], 1);
+		STATS_LAP(VORBIS_STAGE_HEADER, t);
+		
+		decode_floors();
+		STATS_LAP(VORBIS_STAGE_FLOORS, t);
+		
+		// A frame with every floor unused decodes to all-zero spectra: the
+		// residue is never needed, so skip straight to the overlap-add
+		audio.residue_out = NULL;
+		audio.spectrum = new int*[out_channels];
+		for (int i=0; i<out_channels; i++)
+			audio.spectrum[i] = NULL;
+		if (status == VORBIS_OK && !audio.silent_frame) {
+			nonzero_vector_propagate();
+			decode_residues();
+			STATS_LAP(VORBIS_STAGE_RESIDUES, t);
+			inverse_coupling();
+			STATS_LAP(VORBIS_STAGE_COUPLING, t);
+		}
+		if (status != VORBIS_OK)
+			conceal_packet();
+		
+		if (downmix != NULL)
+			downmix_spectrum();
+		else {
+			// Dot product, for the channels inverse coupling didn't do
+			for (int i=0; i<out_channels; i++) {
+				if (audio.silent[i] == 1 || audio.spectrum[i] != NULL)
+					continue;
+				audio.spectrum[i] = new_spectrum();
+				for (int j=0; j<audio.spectrum_limit; j++)
+					audio.spectrum[i][j] = (int)(audio.floor_out[i][j] * audio.residue_out[i][j] * spectrum_scale);
 			}
+		}
+		STATS_LAP(VORBIS_STAGE_SPECTRUM, t);
+		
+		// IMDCT; the transform of silence is silence
+		for (int i=0; i<out_channels; i++) {
+			if (audio.spectrum[i] != NULL)
+				imdct(audio.spectrum[i], audio.synthesis_n);
+		}
+		STATS_LAP(VORBIS_STAGE_IMDCT, t);
+		
+		/** Begin stolen */
+		int out_begin = 0;
+		int out_end = 0;
+		int n1 = info.blocksize_1 / options.decimation;
+		const lap_descriptor *lap = &laps[LAP_INDEX(audio.last_n==info.blocksize_1, audio.n==info.blocksize_1)];
+		
+		int packet_samples = 0;
+		if (!first_packet)
+			out_end = (audio.n/4 + audio.last_n/4) / options.decimation;
+		else
+			first_packet = false;
+		
+		if(out_begin>-1 && out_begin<out_end){
+			int n=out_end-out_begin;
 			
-			decode_residues();
+			// Hand the block over before this packet would overflow it
+			int out_max = (resampler != NULL ? resampler->max_output(n) : n);
+			if (pcm_fill + out_max > pcm_capacity)
+				flush_pcm();
 			
-			// Inverse coupling
-			for (int i=audio.mapping->coupling_steps-1; i>=0; i--) {
-				double *magnitude_vector = audio.residue_out[audio.mapping->magnitude[i]];
-				double *angle_vector = audio.residue_out[audio.mapping->angle[i]];
-				for (int j=0; j<audio.n/2; j++) {
-					double M = magnitude_vector[j];
-					double A = angle_vector[j];
-					double new_M;
-					double new_A;
-					
-					if (M > 0) {
-						if (A > 0) {
-							new_M = M;
-							new_A = M - A;
-						} else {
-							new_A = M;
-							new_M = M + A;
-						}
+			int produced = n;
+			for(int i=0;i<out_channels;i++) {
+				int pcm_step;
+				char *out = pcm_channel_out(i, &pcm_step);
+				if (resampler != NULL) {
+					// Lap to Q format, convert the rate, then write the format
+					pcm_q q;
+					if (audio.spectrum[i] == NULL && mdctright_silent[i]) {
+						for (int j=0; j<n; j++)
+							resample_in[j] = 0;
+					} else
+						mdct_unroll_lap_pcm(lap, audio.spectrum[i], mdctright[i], q, resample_in, 1, out_begin, out_begin+n);
+					produced = resampler->process(i, resample_in, n, resample_out);
+					store_channel(resample_out, produced, out, pcm_step);
+				} else if (audio.spectrum[i] == NULL && mdctright_silent[i]) {
+					// Silence lapped onto silence
+					if (pcm_bytes == 2) {
+						for (int j=0; j<n; j++)
+							((ogg_int16_t *)out)[j*pcm_step] = 0;
 					} else {
-						if (A > 0) {
-							new_M = M;
-							new_A = M + A;
-						} else {
-							new_A = M;
-							new_M = M - A;
-						}
+						for (int j=0; j<n; j++)
+							((ogg_int32_t *)out)[j*pcm_step] = 0;
 					}
-					
-					magnitude_vector[j] = new_M;
-					angle_vector[j] = new_A;
-				}
-			}
-			
-			// Allocate space for spectrum data
-			audio.spectrum = new int*[info.audio_channels];
-			for (int i=0; i<info.audio_channels; i++)
-				audio.spectrum[i] = new int[audio.n/2];
-			
-			// Dot product
-			for (int i=0; i<info.audio_channels; i++) {
-				for (int j=0; j<audio.n/2; j++)
-					audio.spectrum[i][j] = (int)(audio.floor_out[i][j] * audio.residue_out[i][j] / 256);
+				} else
+					unroll_channel(i, lap, out, pcm_step, out_begin, out_begin+n);
 			}
-			
-			// IMDCT
-			for (int i=0; i<info.audio_channels; i++)
-				imdct(audio.spectrum[i], audio.n);
-			
-			/** Begin stolen */
-			int samples = 4096/2 / info.audio_channels;
-			int out_begin = 0;
-			int out_end = 0;
-			
-			if (!first_packet)
-				out_end = audio.n/4 + audio.last_n/4;
-			else
-				first_packet = false;
-			
-			if(out_begin>-1 && out_begin<out_end){
-				int n=out_end-out_begin;
-				if(pcmout){
-					int i;
-					if(n>samples)n=samples;
-					for(i=0;i<info.audio_channels;i++)
-						mdct_unroll_lap(info.blocksize_0,
-										info.blocksize_1,
-										(audio.last_n==info.blocksize_1),
-										(audio.n==info.blocksize_1),
-										audio.spectrum[i],
-										mdctright[i],
-										_vorbis_window(info.blocksize_0/2),
-										_vorbis_window(info.blocksize_1/2),
-										(short *)pcmout+i,
-										info.audio_channels,
-										out_begin,
-										out_begin+n);
-				}
-				fwrite(pcmout, 1, n*info.audio_channels*2, stdout);
+			pcm_fill += produced;
+			packet_samples = produced;
+		}
+		for(int i=0;i<out_channels;i++) {
+			if (audio.spectrum[i] != NULL) {
+				mdct_shift_right(audio.synthesis_n,audio.spectrum[i],mdctright[i]);
+				mdctright_silent[i] = false;
+			} else if (!mdctright_silent[i]) {
+				for (int j=0; j<n1/4; j++)
+					mdctright[i][j] = 0;
+				mdctright_silent[i] = true;
 			}
-			for(int i=0;i<info.audio_channels;i++)
-				mdct_shift_right(audio.n,audio.spectrum[i],mdctright[i]);
-			
-			/** End stolen*/
-			
-			// Cleanup
-			for (int i=0; i<info.audio_channels; i++)
-				delete audio.floor_out[i];
-			delete audio.floor_out;
-			
-			delete audio.residue_out;
-			
-			delete audio.no_residue;
-			
-			for (int i=0; i<info.audio_channels; i++)
-				delete audio.spectrum[i];
-			delete audio.spectrum;
 		}
+		
+		/** End stolen*/
+		
+		// Cleanup
+		free_packet_vectors();
+		for (int i=0; i<out_channels; i++)
+			delete [] audio.spectrum[i];
+		delete [] audio.spectrum;
+		STATS_LAP(VORBIS_STAGE_OUTPUT, t);
+		
+		sink->packet_decoded(packet_samples, (resampler != NULL ? options.resample_rate : info.audio_sample_rate / options.decimation));
 	}
-};
+	
+	// Drop any of the packet left unread, e.g. residue past the band limit
+	skip_packet();
+}
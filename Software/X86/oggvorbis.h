@@ -21,103 +21,210 @@
 #ifndef OGGVORBIS_H
 #define OGGVORBIS_H
 
-#include "packet.h"
-#include "codebook.h"
-#include "floor1.h"
-#include "residue.h"
-#include "mapping.h"
-#include "mode.h"
+#include <cstddef>
+#include "pcmsink.h"
 
-typedef struct ogg_page {
-	/** Capture pattern */
-	int capture_pattern;
-	/** Version */
-	int version;
-	/** Header type */
-	int header_type;
-	/** Granule position */
-	long long granule_position;
-	/** Bitstream serial number */
-	int bitstream_serial_number;
-	/** Page sequence number */
-	int sequence_number;
-	/** CRC checksum */
-	int CRC_checksum;
-	/** Page segments */
-	int segments;
-	/** Segment table */
-	int *segment_table;
-	
-	/** Page data length */
-	int data_length;
-	/** Page data */
-	int *data;
-	
-	/** Vorbis packet */
-	Packet packet;
-} ogg_page;
+typedef enum vorbis_status {
+	/** No error */
+	VORBIS_OK = 0,
+	/** The input file couldn't be opened */
+	VORBIS_ERR_OPEN,
+	/** A page failed its capture pattern, version, header type or CRC
+	 *  check and was dropped */
+	VORBIS_ERR_PAGE,
+	/** An ID, comment or setup header packet was malformed */
+	VORBIS_ERR_HEADER,
+	/** The setup header described an invalid or unsupported configuration */
+	VORBIS_ERR_SETUP,
+	/** An audio packet couldn't be decoded and was replaced with silence */
+	VORBIS_ERR_PACKET
+} vorbis_status;
+
+/** Stages of audio packet decode, as timed in decode_stats */
+typedef enum decode_stage {
+	/** Packet type, mode and window flags */
+	VORBIS_STAGE_HEADER = 0,
+	/** Floor curves */
+	VORBIS_STAGE_FLOORS,
+	/** Residue vectors */
+	VORBIS_STAGE_RESIDUES,
+	/** Inverse channel coupling */
+	VORBIS_STAGE_COUPLING,
+	/** Floor times residue, and any downmix */
+	VORBIS_STAGE_SPECTRUM,
+	/** Inverse MDCT */
+	VORBIS_STAGE_IMDCT,
+	/** Overlap-add, rate conversion and PCM output */
+	VORBIS_STAGE_OUTPUT,
+	VORBIS_STAGE_COUNT
+} decode_stage;
+
+/** Blocksize histogram slots: blocksizes are powers of two up to 8192 */
+#define VORBIS_STATS_BLOCKSIZES 14
+
+/**
+ * Where decode time goes, for a decoder built with VORBIS_STATS defined.
+ * Counts run over every stream the decoder has read
+ */
+typedef struct decode_stats {
+	/** Cycles (the TSC on x86, nanoseconds elsewhere) spent in each stage */
+	unsigned long long stage_cycles[VORBIS_STAGE_COUNT];
+	/** Audio packets decoded */
+	long long packets;
+	/** Pages read in */
+	long long pages;
+	/** Bytes run through the page CRC */
+	long long crc_bytes;
+	/** Bits read from packets */
+	long long bits_read;
+	/** Codewords decoded by walking a Huffman tree */
+	long long huffman_decodes;
+	/** Codewords turned into VQ vectors (each also a Huffman decode) */
+	long long vq_lookups;
+	/** Audio packets by blocksize: slot i counts blocksize 1<<i */
+	long long blocksizes[VORBIS_STATS_BLOCKSIZES];
+	/** Residue vectors decoded, by residue type */
+	long long residue_types[3];
+} decode_stats;
 
-typedef struct vorbis_info {
-	/** Vorbis ID header - audio channels */
-	int audio_channels;
-	/** Vorbis ID header - audio sample rate */
-	int audio_sample_rate;
+typedef enum replaygain_mode {
+	/** Output the stream at its coded level */
+	REPLAYGAIN_OFF = 0,
+	/** Apply REPLAYGAIN_TRACK_GAIN, or the album gain if there's none */
+	REPLAYGAIN_TRACK,
+	/** Apply REPLAYGAIN_ALBUM_GAIN, or the track gain if there's none */
+	REPLAYGAIN_ALBUM
+} replaygain_mode;
+
+typedef struct decode_options {
+	/** Highest frequency (Hz) to reconstruct; 0 decodes the full band */
+	int bandlimit_hz;
+	/** Output sample rate divisor: 1, 2 or 4 (synthesized by a reduced-size IMDCT) */
+	int decimation;
+	/** Where decoded PCM goes; NULL writes to stdout */
+	PCMSink *sink;
+	/** Deliver one contiguous buffer per channel instead of interleaved PCM */
+	bool planar;
+	/** Output sample size: 16, or 24 or 32 in 32-bit containers */
+	int bits;
+	/** Apply TPDF dither to 16-bit output */
+	bool dither;
+	/** Mix down to this many channels in the spectral domain; 0 keeps them
+	 *  all. Without a matrix, streams of up to 8 channels mix to 1 or 2
+	 *  (any more keeps them all), each output row scaled to sum to 1 so
+	 *  the mix can't clip: a 5.1 source panned hard left comes out 7.7 dB
+	 *  down, for one */
+	int downmix_channels;
+	/** downmix_channels x downmix_matrix_channels gains, row-major; NULL
+	 *  uses the standard mix of the Vorbis channel layout */
+	const double *downmix_matrix;
+	/** Input channels downmix_matrix is written for; a chain link with a
+	 *  different count gets the standard mix instead */
+	int downmix_matrix_channels;
+	/** Output sample rate, converted in the decoder; 0 keeps the stream's */
+	int resample_rate;
+	/** Only read the ID and comment headers and the stream length: no
+	 *  setup header, codebooks or audio */
+	bool probe;
+	/** Skip user comments longer than this many bytes (e.g. embedded
+	 *  pictures) without storing them; 0 keeps them all */
+	int comment_limit;
+	/** Which ReplayGain tag to scale the spectrum by */
+	replaygain_mode replaygain;
+	/** Extra gain in dB on top of the ReplayGain tag, within +-15 dB */
+	double replaygain_preamp;
+} decode_options;
+
+class VorbisDecoder;
+
+/**
+ * Decodes an Ogg/Vorbis file, chained streams and all, into a PCMSink. The
+ * whole decode runs in the constructor; the stream's headers stay readable
+ * through the accessors afterwards. In a chain, they are the headers of
+ * the last link read.
+ */
+class OggVorbis {
+public:
+	/**
+	 * Constructor which sets off the Ogg/Vorbis decoding process
+	 * @param filename The file to read from
+	 * @param opts Decode settings, or NULL for a full decode
+	 */
+	OggVorbis(char *filename, decode_options *opts = NULL);
 	
-	/** Vorbis ID header - bitrate maximum */
-	int bitrate_maximum;
-	/** Vorbis ID header - bitrate nominal */
-	int bitrate_nominal;
-	/** Vorbis ID header - bitrate minimum */
-	int bitrate_minimum;
+	/**
+	 * Frees the headers and closes the file
+	 */
+	~OggVorbis();
 	
-	/** Vorbis ID header - blocksize 0 */
-	int blocksize_0;
-	/** Vorbis ID header - blocksize 1 */
-	int blocksize_1;
+	/**
+	 * @return Were the last stream's headers all read successfully?
+	 */
+	bool headers_ok();
 	
-	/** Vorbis comment header - vendor length */
-	int vendor_length;
-	/** Vorbis comment header - vendor string */
-	int *vendor_string;
+	/**
+	 * @return The first error met anywhere in the file, or VORBIS_OK
+	 */
+	vorbis_status error();
 	
-	/** Vorbis comment header - user comment list length */
-	int user_comment_list_length;
-	/** Vorbis comment header - user comment length array */
-	int *user_comment_length;
-	/** Vorbis comment header - user comment array */
-	int **user_comment;
+	/** @return Audio channels in the stream, before any downmix */
+	int channels();
+	/** @return Sample rate of the stream, before any decimation or resampling */
+	int sample_rate();
+	/** @return The ID header's maximum bitrate; 0 or less if unset */
+	int bitrate_maximum();
+	/** @return The ID header's nominal bitrate; 0 or less if unset */
+	int bitrate_nominal();
+	/** @return The ID header's minimum bitrate; 0 or less if unset */
+	int bitrate_minimum();
 	
-	/** Vorbis setup header - codebooks - codebook count */
-	int vorbis_codebook_count;
-	/** Vorbis setup header - codebooks - storage array */
-	Codebook *codebook_config;
+	/**
+	 * @return Length of the stream in samples, from its last page's granule
+	 * position; -1 if unknown, as for a chain of more than one link. Only
+	 * found when probing
+	 */
+	long long length_samples();
 	
-	/** Vorbis setup header - time domain transforms - time count */
-	int vorbis_time_count;
+	/**
+	 * @param length Set to the length of the vendor string
+	 * @return The comment header's vendor string: UTF-8, not NUL terminated
+	 */
+	const char *vendor(int *length);
 	
-	/** Vorbis setup header - floors - floor count */
-	int vorbis_floor_count;
-	/** Vorbis setup header - floors - floor types array */
-	int *vorbis_floor_types;
-	/** Vorbis setup header - floors - storage array */
-	Floor1 *floor_config;
+	/**
+	 * @return The number of user comments kept
+	 */
+	int comment_count();
 	
-	/** Vorbis setup header - residues - residue count */
-	int vorbis_residue_count;
-	/** Vorbis setup header - residues - residue types array */
-	int *vorbis_residue_types;
-	/** Vorbis setup header - residues - storage array */
-	Residue *residue_config;
+	/**
+	 * @param index Which comment, from 0 to comment_count()-1
+	 * @param length Set to the length of the comment
+	 * @return The comment: UTF-8 "NAME=value", not NUL terminated
+	 */
+	const char *user_comment(int index, int *length);
 	
-	/** Vorbis setup header - mappings - mapping count */
-	int vorbis_mapping_count;
-	/** Vorbis setup header - mappings - storage array */
-	Mapping *mapping_config;
+	/**
+	 * Looks up a user comment by field name, case-insensitively
+	 * @param name The field name, e.g. "ARTIST" or "REPLAYGAIN_TRACK_GAIN"
+	 * @param length Set to the length of the value
+	 * @param index Which of the fields of that name to find (0 for the first)
+	 * @return The value, not NUL terminated, or NULL if there's no such field
+	 */
+	const char *comment(const char *name, int *length, int index = 0);
+	
+	/**
+	 * @return Decode counters and stage timings, or NULL unless the library
+	 * was built with VORBIS_STATS defined
+	 */
+	const decode_stats *stats();
+
+private:
+	/** The decoder itself */
+	VorbisDecoder *decoder;
 	
-	/** Vorbis setup header - modes - mode count */
-	int vorbis_mode_count;
-	/** Vorbis setup header - modes - storage array */
-	Mode *mode_config;
-} vorbis_info;
+	// Not copyable: the decoder is owned
+	OggVorbis(const OggVorbis &);
+	OggVorbis &operator=(const OggVorbis &);
+};
 
 #endif
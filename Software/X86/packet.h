@@ -37,6 +37,8 @@ class Packet {
 		int bitpos;
 		/** Does this packet span a page boundary? False if yes. */
 		bool end_of_packet;
+		/** Does this packet start with the tail of one from an earlier page? */
+		bool continued;
 };
 
 #endif
@@ -0,0 +1,309 @@
+/***************************************************************************
+ *   Copyright (C) 2008 by Steve Heindel   *
+ *   stevenheindel@gmail.com   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#ifndef PCMSINK_H
+#define PCMSINK_H
+
+#include <unistd.h>
+#include <cstring>
+#include <pthread.h>
+
+/**
+ * Destination for decoded PCM. The decoder collects output into large
+ * blocks and hands each block over with a single write() call, or a single
+ * write_planar() call in planar mode.
+ */
+class PCMSink {
+	public:
+		virtual ~PCMSink() {}
+		
+		/**
+		* Receives a block of interleaved native-endian samples, 16-bit or
+		* 32-bit as the decoder was configured
+		* @param data The PCM block
+		* @param bytes The length of the block in bytes
+		*/
+		virtual void write(const char *data, int bytes) = 0;
+		
+		/**
+		* Receives a block of planar samples; by default each channel
+		* is passed on to write() in turn
+		* @param planes One PCM buffer per channel
+		* @param channels The number of channels
+		* @param bytes The length of each channel's buffer in bytes
+		*/
+		virtual void write_planar(char **planes, int channels, int bytes) {
+			for (int i=0; i<channels; i++)
+				write(planes[i], bytes);
+		}
+		
+		/**
+		* Called as each audio packet finishes decoding, whether or not its
+		* PCM has been handed over yet
+		* @param samples Samples per channel the packet added to the output
+		* @param rate The output sample rate of the chain link it belongs to
+		*/
+		virtual void packet_decoded(int, int) {}
+		
+		/**
+		* Called before the first block of each chain link, whose blocks
+		* all share this layout
+		* @param channels Output channels
+		* @param bytes Bytes per sample
+		*/
+		virtual void output_started(int, int) {}
+};
+
+/**
+ * Writes PCM to a file descriptor (stdout unless told otherwise)
+ */
+class FilePCMSink : public PCMSink {
+	public:
+		/** The descriptor to write to */
+		int fd;
+		/** Set if a write failed; later blocks are dropped */
+		bool error;
+		
+		FilePCMSink(int setfd = 1) {
+			fd = setfd;
+			error = false;
+		}
+		
+		void write(const char *data, int bytes) {
+			while (bytes > 0 && !error) {
+				ssize_t written = ::write(fd, data, bytes);
+				if (written <= 0)
+					error = true;
+				else {
+					data += written;
+					bytes -= written;
+				}
+			}
+		}
+};
+
+/**
+ * Appends PCM to a caller-supplied buffer
+ */
+class BufferPCMSink : public PCMSink {
+	public:
+		/** The caller's buffer */
+		char *buffer;
+		/** Size of the buffer in bytes */
+		int capacity;
+		/** Bytes stored so far */
+		int length;
+		/** Bytes that did not fit in the buffer */
+		long long overflow;
+		
+		BufferPCMSink(char *setbuffer, int setcapacity) {
+			buffer = setbuffer;
+			capacity = setcapacity;
+			length = 0;
+			overflow = 0;
+		}
+		
+		void write(const char *data, int bytes) {
+			int room = capacity - length;
+			if (bytes > room) {
+				overflow += bytes - room;
+				bytes = room;
+			}
+			memcpy(buffer + length, data, bytes);
+			length += bytes;
+		}
+};
+
+/**
+ * Appends planar PCM to caller-supplied per-channel buffers
+ */
+class PlanarBufferPCMSink : public PCMSink {
+	public:
+		/** The caller's buffers, one per channel */
+		char **buffers;
+		/** Number of buffers */
+		int channels;
+		/** Size of each buffer in bytes */
+		int capacity;
+		/** Bytes stored so far in each buffer */
+		int length;
+		/** Bytes per channel that did not fit */
+		long long overflow;
+		
+		PlanarBufferPCMSink(char **setbuffers, int setchannels, int setcapacity) {
+			buffers = setbuffers;
+			channels = setchannels;
+			capacity = setcapacity;
+			length = 0;
+			overflow = 0;
+		}
+		
+		/** Interleaved PCM has no place here; it is counted as overflow */
+		void write(const char *, int bytes) {
+			overflow += bytes;
+		}
+		
+		void write_planar(char **planes, int count, int bytes) {
+			int room = capacity - length;
+			if (bytes > room) {
+				overflow += bytes - room;
+				bytes = room;
+			}
+			for (int i=0; i<count && i<channels; i++)
+				memcpy(buffers[i] + length, planes[i], bytes);
+			length += bytes;
+		}
+};
+
+/**
+ * Fixed-size ring buffer between the thread running the decoder and a
+ * consumer thread. write() waits while the ring is full and read() waits
+ * while it is empty, so nothing is dropped, and read() only hands out whole
+ * frames. A chain link with a different layout waits for the ring to empty
+ * before it starts. For interleaved output only.
+ *
+ * The decoder thread calls close() once the decoder returns; read() then
+ * drains what is left and returns 0. A consumer that stops early calls
+ * close() too, and the decoder's remaining PCM is discarded.
+ */
+class RingPCMSink : public PCMSink {
+	public:
+		/** Ring storage */
+		char *buffer;
+		/** Size of the ring in bytes */
+		int capacity;
+		/** Read position */
+		int head;
+		/** Bytes waiting to be read */
+		int length;
+		/** Channels in each frame of the current link, 0 before the first */
+		int channels;
+		/** Bytes per frame of the current link */
+		int frame;
+		/** Set by close() */
+		bool closed;
+		pthread_mutex_t lock;
+		/** Signalled whenever length or closed changes */
+		pthread_cond_t changed;
+		
+		/**
+		* @param setcapacity Size of the ring in bytes; at least one long
+		* block of output (blocksize_1/2 frames) keeps the decoder from
+		* waiting on every packet
+		*/
+		RingPCMSink(int setcapacity) {
+			buffer = new char[setcapacity];
+			capacity = setcapacity;
+			head = 0;
+			length = 0;
+			channels = 0;
+			frame = 1;
+			closed = false;
+			pthread_mutex_init(&lock, NULL);
+			pthread_cond_init(&changed, NULL);
+		}
+		
+		~RingPCMSink() {
+			pthread_cond_destroy(&changed);
+			pthread_mutex_destroy(&lock);
+			delete [] buffer;
+		}
+		
+		void output_started(int setchannels, int bytes) {
+			pthread_mutex_lock(&lock);
+			while (length > 0 && !closed)
+				pthread_cond_wait(&changed, &lock);
+			channels = setchannels;
+			frame = setchannels * bytes;
+			head = 0; // Keeps the ring a whole number of frames from here on
+			pthread_mutex_unlock(&lock);
+		}
+		
+		void write(const char *data, int bytes) {
+			pthread_mutex_lock(&lock);
+			// Whole frames in, whole frames out: the room is rounded down
+			// to frames so a frame is never split between two waits
+			int usable = capacity - capacity % frame;
+			while (bytes > 0 && !closed) {
+				int room = usable - length;
+				if (room < frame) {
+					pthread_cond_wait(&changed, &lock);
+					continue;
+				}
+				
+				int n = (bytes < room ? bytes : room - room % frame);
+				int tail = (head + length) % usable;
+				int first = usable - tail;
+				if (first > n)
+					first = n;
+				memcpy(buffer + tail, data, first);
+				memcpy(buffer, data + first, n - first);
+				length += n;
+				data += n;
+				bytes -= n;
+				pthread_cond_broadcast(&changed);
+			}
+			pthread_mutex_unlock(&lock);
+		}
+		
+		/**
+		* Takes whole frames out of the ring, waiting for the decoder if
+		* it is empty
+		* @param data Where to copy the PCM
+		* @param bytes Room at data; at least one frame
+		* @param setchannels If not NULL, gets the channels per frame
+		* @return The number of bytes copied; 0 once the ring is closed
+		* and empty
+		*/
+		int read(char *data, int bytes, int *setchannels = NULL) {
+			pthread_mutex_lock(&lock);
+			while (length == 0 && !closed)
+				pthread_cond_wait(&changed, &lock);
+			
+			int usable = capacity - capacity % frame;
+			if (bytes > length)
+				bytes = length;
+			bytes -= bytes % frame;
+			int first = usable - head;
+			if (first > bytes)
+				first = bytes;
+			memcpy(data, buffer + head, first);
+			memcpy(data + first, buffer, bytes - first);
+			
+			head = (head + bytes) % usable;
+			length -= bytes;
+			if (setchannels != NULL)
+				*setchannels = channels;
+			pthread_cond_broadcast(&changed);
+			pthread_mutex_unlock(&lock);
+			return bytes;
+		}
+		
+		/** Ends the stream; see the class comment */
+		void close() {
+			pthread_mutex_lock(&lock);
+			closed = true;
+			pthread_cond_broadcast(&changed);
+			pthread_mutex_unlock(&lock);
+		}
+};
+
+#endif
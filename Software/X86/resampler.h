@@ -0,0 +1,249 @@
+/***************************************************************************
+ *   Copyright (C) 2008 by Steve Heindel   *
+ *   stevenheindel@gmail.com   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define RESAMPLER_SSE
+#endif
+
+/* Most filter phases kept in the table: 1024 rows of at most 256 taps is
+   1 MB. Common rate pairs need no more than 640; a co-prime pair such as
+   44100 to 44101 Hz would need one row per output rate unit, so it uses
+   the nearest row below its exact phase instead */
+#define RESAMPLER_MAX_PHASES 1024
+
+/**
+ * Streaming polyphase FIR sample rate converter for a fixed rational
+ * ratio. Works on the decoder's Q-format lapped samples, one channel at a
+ * time, so it sits between the overlap-add and the PCM writers. Its output
+ * is only the same from one build to another if the file that includes it
+ * is compiled without floating-point contraction (-ffp-contract=off);
+ * CMakeLists.txt sees to that for oggvorbis.cpp.
+ */
+class Resampler {
+	public:
+		/** Input rate / gcd */
+		int M;
+		/** Output rate / gcd (the number of filter phases) */
+		int L;
+		/** Taps per phase (a multiple of 4) */
+		int taps;
+		/** Rows in the filter table: L, or at most RESAMPLER_MAX_PHASES */
+		int phases;
+		/** Filter table, phases rows of taps coefficients */
+		float *coef;
+		
+		/** Number of channels */
+		int channels;
+		/** Per-channel input history: taps-1 old samples, then new ones */
+		float **history;
+		/** Samples held in each history; the next output's first tap is at 0 */
+		int count;
+		/** Filter phase of the next output */
+		int phase;
+		/** Input samples to drop before the next output's first tap */
+		int skip;
+		/** Most input samples handed to process() at once */
+		int max_block;
+		
+		/**
+		* Builds the filter table for a rate pair
+		* @param in_rate The input sample rate
+		* @param out_rate The output sample rate
+		* @param setchannels The number of channels to convert
+		* @param setmax_block The most samples per channel per process() call
+		*/
+		Resampler(int in_rate, int out_rate, int setchannels, int setmax_block) {
+			int g = gcd(in_rate, out_rate);
+			M = in_rate / g;
+			L = out_rate / g;
+			channels = setchannels;
+			max_block = setmax_block;
+			
+			// Downsampling lowers the cutoff, so the filter spans more input
+			taps = 32;
+			if (M > L) {
+				taps = (32 * M / L + 3) & ~3;
+				if (taps > 256)
+					taps = 256;
+			}
+			
+			// Windowed sinc below the lower Nyquist, one row per output phase
+			double cutoff = 0.45 * (L < M ? (double)L / M : 1.0); // Cycles per input sample
+			double beta = 8.0;
+			phases = (L > RESAMPLER_MAX_PHASES ? RESAMPLER_MAX_PHASES : L);
+			coef = new float[phases * taps];
+			for (int p=0; p<phases; p++) {
+				double sum = 0;
+				double *row = new double[taps];
+				for (int k=0; k<taps; k++) {
+					double t = (double)p / phases + taps/2 - 1 - k; // Input samples from the tap
+					double x = 2 * cutoff * t;
+					double sinc = (t == 0 ? 1.0 : sin(M_PI * x) / (M_PI * x));
+					double w = t / (taps/2);
+					w = (w*w < 1 ? bessel_i0(beta * sqrt(1 - w*w)) / bessel_i0(beta) : 0);
+					row[k] = sinc * w;
+					sum += row[k];
+				}
+				for (int k=0; k<taps; k++) // Unity gain at DC in every phase
+					coef[p*taps + k] = (float)(row[k] / sum);
+				delete [] row;
+			}
+			
+			history = new float*[channels];
+			for (int i=0; i<channels; i++) {
+				history[i] = new float[taps + max_block];
+				for (int j=0; j<taps + max_block; j++)
+					history[i][j] = 0;
+			}
+			
+			// Start with taps/2-1 zeros so output 0 lines up with input 0
+			count = taps/2 - 1;
+			phase = 0;
+			skip = 0;
+		}
+		
+		~Resampler() {
+			for (int i=0; i<channels; i++)
+				delete [] history[i];
+			delete [] history;
+			delete [] coef;
+		}
+		
+		/**
+		* @return The most output samples process() can return for n inputs
+		*/
+		int max_output(int n) {
+			return (int)(((long long)(count + n) * L) / M) + 1;
+		}
+		
+		/**
+		* Converts a block of one channel. Every channel must be given the
+		* same number of samples, in channel order, before the next block.
+		* @param channel The channel the samples belong to
+		* @param in Q-format input samples
+		* @param n The number of input samples (at most max_block)
+		* @param out Where to put the Q-format output samples
+		* @return The number of output samples
+		*/
+		int process(int channel, const int *in, int n, int *out) {
+			float *x = history[channel];
+			int skipped = (skip < n ? skip : n);
+			for (int i=skipped; i<n; i++)
+				x[count + i - skipped] = (float)in[i];
+			
+			int avail = count + n - skipped;
+			int pos = 0;
+			int ph = phase;
+			int produced = 0;
+			while (pos + taps <= avail) {
+				int row = (phases == L ? ph : (int)((long long)ph * phases / L));
+				float y = dot(coef + row*taps, x + pos);
+				out[produced++] = (int)(y < 0 ? y - 0.5f : y + 0.5f);
+				ph += M;
+				pos += ph / L;
+				ph %= L;
+			}
+			
+			// Far enough below the input rate, the last step can land past
+			// everything read so far; the overshoot comes out of later blocks
+			int left = skip - skipped;
+			if (pos > avail) {
+				left += pos - avail;
+				pos = avail;
+			}
+			
+			// Keep the unread tail for the next block
+			memmove(x, x + pos, (avail - pos) * sizeof(float));
+			
+			// The shared position only moves once the last channel is done
+			if (channel == channels - 1) {
+				count = avail - pos;
+				phase = ph;
+				skip = left;
+			}
+			return produced;
+		}
+		
+		/**
+		* @return The number of zero samples that push the last real input
+		* through the filter at the end of a stream
+		*/
+		int drain_length() {
+			return taps/2;
+		}
+		
+	private:
+		static int gcd(int a, int b) {
+			while (b != 0) {
+				int t = a % b;
+				a = b;
+				b = t;
+			}
+			return a;
+		}
+		
+		/** Zeroth order modified Bessel function, for the Kaiser window */
+		static double bessel_i0(double x) {
+			double sum = 1, term = 1;
+			for (int k=1; k<50; k++) {
+				term *= (x / (2*k)) * (x / (2*k));
+				sum += term;
+			}
+			return sum;
+		}
+		
+		/** Filter dot product over taps coefficients */
+		inline float dot(const float *c, const float *x) {
+#ifdef RESAMPLER_SSE
+			__m128 acc0 = _mm_setzero_ps();
+			__m128 acc1 = _mm_setzero_ps();
+			int k = 0;
+			for (; k+8<=taps; k+=8) {
+				acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(c+k), _mm_loadu_ps(x+k)));
+				acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(c+k+4), _mm_loadu_ps(x+k+4)));
+			}
+			for (; k<taps; k+=4)
+				acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(c+k), _mm_loadu_ps(x+k)));
+			acc0 = _mm_add_ps(acc0, acc1);
+			acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+			acc0 = _mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, 1));
+			return _mm_cvtss_f32(acc0);
+#else
+			float a0 = 0, a1 = 0, a2 = 0, a3 = 0;
+			for (int k=0; k<taps; k+=4) {
+				a0 += c[k] * x[k];
+				a1 += c[k+1] * x[k+1];
+				a2 += c[k+2] * x[k+2];
+				a3 += c[k+3] * x[k+3];
+			}
+			return (a0 + a1) + (a2 + a3);
+#endif
+		}
+};
+
+#endif
@@ -24,15 +24,350 @@
 #endif
 
 #include <iostream>
+#include <iomanip>
 #include <cstdlib>
+#include <cstring>
+#include <time.h>
+#include <pthread.h>
+#include <sys/resource.h>
 
-#include "oggvorbis.cpp"
+#include "oggvorbis.h"
 
 using namespace std;
 
+/** Seconds on a monotonic clock */
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Throws the PCM away and times each packet: from the end of one packet to
+ * the end of the next, so reading its pages counts too. The first packet
+ * of a file has nothing before it and is not timed.
+ */
+class LatencyPCMSink : public PCMSink {
+	public:
+		/** Seconds each packet took */
+		double *latencies;
+		int count;
+		int capacity;
+		/** Seconds of audio decoded, each packet at its own link's rate */
+		double audio_seconds;
+		/** When the last packet finished, or 0 before the first */
+		double last;
+		
+		LatencyPCMSink() {
+			capacity = 1024;
+			latencies = new double[capacity];
+			count = 0;
+			audio_seconds = 0;
+			last = 0;
+		}
+		
+		~LatencyPCMSink() {
+			delete [] latencies;
+		}
+		
+		void write(const char *, int) {}
+		void write_planar(char **, int, int) {}
+		
+		void packet_decoded(int produced, int rate) {
+			double t = now();
+			if (last > 0) {
+				if (count == capacity) {
+					double *grown = new double[capacity * 2];
+					memcpy(grown, latencies, count * sizeof(double));
+					delete [] latencies;
+					latencies = grown;
+					capacity *= 2;
+				}
+				latencies[count++] = t - last;
+			}
+			last = t;
+			if (rate > 0)
+				audio_seconds += (double)produced / rate;
+		}
+};
+
+/** One file of a benchmark run */
+struct bench_file {
+	char *name;
+	LatencyPCMSink sink;
+	/** Wall time to decode it */
+	double seconds;
+	/** Seconds of audio it decoded to */
+	double audio_seconds;
+	/** False if no stream could be set up */
+	bool ok;
+};
+
+/** Files shared out between the benchmark threads */
+struct bench_queue {
+	bench_file *files;
+	int count;
+	/** The next file to hand out */
+	int next;
+	pthread_mutex_t lock;
+	const decode_options *options;
+};
+
+/**
+ * Benchmark thread: decodes files off the queue until none are left
+ * @param arg The bench_queue
+ */
+static void *bench_worker(void *arg) {
+	bench_queue *queue = (bench_queue *)arg;
+	while (true) {
+		pthread_mutex_lock(&queue->lock);
+		int i = queue->next++;
+		pthread_mutex_unlock(&queue->lock);
+		if (i >= queue->count)
+			break;
+		
+		bench_file &f = queue->files[i];
+		decode_options options = *queue->options;
+		options.sink = &f.sink;
+		options.probe = false;
+		
+		double started = now();
+		OggVorbis ov(f.name, &options);
+		f.seconds = now() - started;
+		f.ok = ov.headers_ok();
+		f.audio_seconds = f.sink.audio_seconds;
+	}
+	return NULL;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+/**
+ * Decodes files to a null sink on several threads and prints the total
+ * time, realtime factor, per-packet latency and peak memory
+ * @param files The files
+ * @param count How many
+ * @param threads Decoder threads
+ * @param options Decode options for every file
+ * @return 0, or 1 if a file could not be decoded
+ */
+static int benchmark(char **files, int count, int threads, const decode_options &options) {
+	bench_queue queue;
+	queue.files = new bench_file[count];
+	queue.count = count;
+	queue.next = 0;
+	queue.options = &options;
+	pthread_mutex_init(&queue.lock, NULL);
+	for (int i=0; i<count; i++) {
+		queue.files[i].name = files[i];
+		queue.files[i].seconds = 0;
+		queue.files[i].audio_seconds = 0;
+		queue.files[i].ok = false;
+	}
+	
+	if (threads < 1)
+		threads = 1;
+	if (threads > count)
+		threads = count;
+	pthread_t *workers = new pthread_t[threads];
+	double started = now();
+	for (int i=0; i<threads; i++)
+		pthread_create(&workers[i], NULL, bench_worker, &queue);
+	for (int i=0; i<threads; i++)
+		pthread_join(workers[i], NULL);
+	double seconds = now() - started;
+	delete [] workers;
+	pthread_mutex_destroy(&queue.lock);
+	
+	// Pool the packet times of every file
+	int failed = 0;
+	int packets = 0;
+	double audio_seconds = 0;
+	for (int i=0; i<count; i++) {
+		packets += queue.files[i].sink.count;
+		audio_seconds += queue.files[i].audio_seconds;
+	}
+	double *latencies = new double[packets > 0 ? packets : 1];
+	packets = 0;
+	cout << dec << fixed << setprecision(3);
+	for (int i=0; i<count; i++) {
+		bench_file &f = queue.files[i];
+		memcpy(latencies + packets, f.sink.latencies, f.sink.count * sizeof(double));
+		packets += f.sink.count;
+		if (!f.ok) {
+			cerr << "Unable to decode " << f.name << endl;
+			failed++;
+		}
+		cout << "file=" << f.name << " seconds=" << f.seconds << " audio_seconds=" << f.audio_seconds
+			<< " realtime=" << (f.seconds > 0 ? f.audio_seconds / f.seconds : 0) << endl;
+	}
+	qsort(latencies, packets, sizeof(double), compare_doubles);
+	
+	// Nearest-rank percentiles, in microseconds
+	double p50 = 0, p99 = 0, max = 0;
+	if (packets > 0) {
+		p50 = latencies[(packets * 50 + 99) / 100 - 1] * 1e6;
+		p99 = latencies[(packets * 99 + 99) / 100 - 1] * 1e6;
+		max = latencies[packets - 1] * 1e6;
+	}
+	
+	// Peak resident set size, in kilobytes on Linux
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	
+	cout << "files=" << count << endl;
+	cout << "threads=" << threads << endl;
+	cout << "seconds=" << seconds << endl;
+	cout << "cpu_seconds=" << usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6 << endl;
+	cout << "audio_seconds=" << audio_seconds << endl;
+	cout << "realtime=" << (seconds > 0 ? audio_seconds / seconds : 0) << endl;
+	cout << "packets=" << packets << endl;
+	cout << "latency_p50_us=" << p50 << endl;
+	cout << "latency_p99_us=" << p99 << endl;
+	cout << "latency_max_us=" << max << endl;
+	cout << "peak_rss_kb=" << usage.ru_maxrss << endl;
+	
+	delete [] latencies;
+	delete [] queue.files;
+	return (failed > 0 ? 1 : 0);
+}
+
 int main(int argc, char *argv[])
 {
-	OggVorbis ov(argv[1]);
+	decode_options options;
+	options.bandlimit_hz = 0;
+	options.decimation = 1;
+	options.sink = NULL; // stdout
+	options.planar = false;
+	options.bits = 16;
+	options.dither = false;
+	options.downmix_channels = 0;
+	options.downmix_matrix = NULL;
+	options.downmix_matrix_channels = 0;
+	options.resample_rate = 0;
+	options.probe = false;
+	options.comment_limit = 0;
+	options.replaygain = REPLAYGAIN_OFF;
+	options.replaygain_preamp = 0;
+	
+	char **files = new char*[argc];
+	int file_count = 0;
+	bool print_stats = false;
+	bool bench = false;
+	bool usage = false;
+	int threads = 1;
+	for (int i=1; i<argc; i++) {
+		if (strcmp(argv[i], "-b") == 0 && i+1 < argc) // Band limit in Hz
+			options.bandlimit_hz = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-d") == 0 && i+1 < argc) // Output rate divisor
+			options.decimation = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-p") == 0) // Planar: each block is written channel by channel
+			options.planar = true;
+		else if (strcmp(argv[i], "-s") == 0 && i+1 < argc) // Sample size: 16, 24 or 32 bits
+			options.bits = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-t") == 0) // TPDF dither 16-bit output
+			options.dither = true;
+		else if (strcmp(argv[i], "-m") == 0 && i+1 < argc) // Downmix to this many channels
+			options.downmix_channels = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-r") == 0 && i+1 < argc) // Resample to this rate
+			options.resample_rate = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-i") == 0) // Print stream info instead of decoding
+			options.probe = true;
+		else if (strcmp(argv[i], "-c") == 0 && i+1 < argc) // Skip comments longer than this
+			options.comment_limit = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-g") == 0 && i+1 < argc) { // Apply track or album ReplayGain
+			i++;
+			if (strcmp(argv[i], "album") == 0)
+				options.replaygain = REPLAYGAIN_ALBUM;
+			else if (strcmp(argv[i], "track") == 0)
+				options.replaygain = REPLAYGAIN_TRACK;
+			else
+				usage = true;
+		} else if (strcmp(argv[i], "-a") == 0 && i+1 < argc) // ReplayGain preamp in dB
+			options.replaygain_preamp = atof(argv[++i]);
+		else if (strcmp(argv[i], "-S") == 0) // Print decode stats to stderr
+			print_stats = true;
+		else if (strcmp(argv[i], "-B") == 0) // Benchmark: decode the files to nowhere and report speed
+			bench = true;
+		else if (strcmp(argv[i], "-j") == 0 && i+1 < argc) // Benchmark threads
+			threads = atoi(argv[++i]);
+		else
+			files[file_count++] = argv[i];
+	}
+	
+	if (usage || file_count == 0 || (file_count > 1 && !bench)) {
+		cerr << "Usage: " << argv[0] << " [-b bandlimit_hz] [-d 1|2|4] [-p] [-s 16|24|32] [-t] [-m channels] [-r rate] [-i] [-c comment_limit] [-g track|album] [-a preamp_db] [-S] file.ogg > out.pcm" << endl;
+		cerr << "       " << argv[0] << " -B [-j threads] [decode options] file.ogg..." << endl;
+		delete [] files;
+		return 1;
+	}
+	
+	if (bench) {
+		int result = benchmark(files, file_count, threads, options);
+		delete [] files;
+		return result;
+	}
+	
+	char *filename = files[0];
+	delete [] files;
+	OggVorbis ov(filename, &options);
+	
+	if (options.probe && ov.headers_ok()) {
+		cout << dec;
+		cout << "channels=" << ov.channels() << endl;
+		cout << "rate=" << ov.sample_rate() << endl;
+		cout << "bitrate_maximum=" << ov.bitrate_maximum() << endl;
+		cout << "bitrate_nominal=" << ov.bitrate_nominal() << endl;
+		cout << "bitrate_minimum=" << ov.bitrate_minimum() << endl;
+		cout << "samples=" << ov.length_samples() << endl;
+		if (ov.length_samples() >= 0)
+			cout << "seconds=" << (double)ov.length_samples() / ov.sample_rate() << endl;
+		int length;
+		const char *text = ov.vendor(&length);
+		cout << "vendor=";
+		cout.write(text, length);
+		cout << endl;
+		for (int i=0; i<ov.comment_count(); i++) {
+			text = ov.user_comment(i, &length);
+			cout.write(text, length);
+			cout << endl;
+		}
+	}
+	
+	const decode_stats *stats = ov.stats();
+	if (print_stats && stats == NULL)
+		cerr << "Decode stats need a build with VORBIS_STATS defined" << endl;
+	else if (print_stats) {
+		const char *stages[] = { "header", "floors", "residues", "coupling", "spectrum", "imdct", "output" };
+		cerr << dec;
+		for (int i=0; i<VORBIS_STAGE_COUNT; i++)
+			cerr << "cycles_" << stages[i] << "=" << stats->stage_cycles[i] << endl;
+		cerr << "packets=" << stats->packets << endl;
+		cerr << "pages=" << stats->pages << endl;
+		cerr << "crc_bytes=" << stats->crc_bytes << endl;
+		cerr << "bits_read=" << stats->bits_read << endl;
+		cerr << "huffman_decodes=" << stats->huffman_decodes << endl;
+		cerr << "vq_lookups=" << stats->vq_lookups << endl;
+		for (int i=0; i<VORBIS_STATS_BLOCKSIZES; i++) {
+			if (stats->blocksizes[i] > 0)
+				cerr << "blocksize_" << (1 << i) << "=" << stats->blocksizes[i] << endl;
+		}
+		for (int i=0; i<3; i++)
+			cerr << "residue_type_" << i << "=" << stats->residue_types[i] << endl;
+	}
+	
+	// Bad pages and packets are dropped or concealed and the decode carries
+	// on; it only fails outright if no stream could be set up at all
+	if (ov.error() != VORBIS_OK) {
+		const char *names[] = { "none", "unable to open file", "corrupt page", "bad header", "bad setup header", "bad audio packet" };
+		cerr << "Decoding error: " << names[ov.error()] << (ov.headers_ok() ? " (recovered)" : "") << endl;
+		if (!ov.headers_ok())
+			return 1;
+	}
 	
 	return 0;
 }
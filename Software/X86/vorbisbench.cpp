@@ -0,0 +1,531 @@
+/***************************************************************************
+ *   Copyright (C) 2008 by Steve Heindel   *
+ *   stevenheindel@gmail.com   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * Times each stage of the decoder on its own. A file is first decoded once
+ * to unpack its setup, then its audio packets are replayed through one
+ * stage at a time, with the stages ahead of it run untimed. The IMDCT and
+ * overlap-add are also timed on synthetic spectra at every blocksize.
+ *
+ * Each stage runs for at least the minimum time (-t), so on a long file
+ * only its first packets may be used. The realtime factor is how many
+ * seconds of audio the stage gets through per second: the audio covered is
+ * taken as the share of the file's packet bytes processed.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+#include <time.h>
+
+#include "vorbisdecoder.h"
+
+using namespace std;
+
+/** Throws the PCM away */
+class NullPCMSink : public PCMSink {
+	public:
+		void write(const char *, int) {}
+		void write_planar(char **, int, int) {}
+};
+
+/** A whole audio packet, gathered across pages */
+struct bench_packet {
+	int *data;
+	int length;
+};
+
+/** What one stage did, and how long it took */
+struct bench_result {
+	/** Operations (calls, packets or transforms) */
+	long long ops;
+	/** Input bytes the operations got through */
+	long long bytes;
+	/** Seconds of audio the operations covered */
+	double audio_seconds;
+	/** Seconds taken */
+	double seconds;
+};
+
+/** Seconds on a monotonic clock */
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/** Minimum time to run each stage for */
+static double min_time = 0.25;
+/** Print CSV instead of a table */
+static bool csv = false;
+
+/**
+ * Prints one stage's result, unless it has no operations
+ * @param stage The stage name
+ * @param input The file, or "synthetic"
+ * @param param Blocksize or residue type, or 0 if it has none
+ * @param r The result
+ */
+static void report(const char *stage, const char *input, int param, const bench_result &r) {
+	if (r.ops == 0)
+		return; // Nothing in the input exercised the stage
+
+	double ns_per_op = r.seconds * 1e9 / r.ops;
+	double mb_per_s = (r.seconds > 0 ? r.bytes / r.seconds / 1e6 : 0);
+	double realtime = (r.seconds > 0 ? r.audio_seconds / r.seconds : 0);
+
+	if (csv) {
+		cout << stage << "," << input << "," << param << "," << r.ops << ","
+			<< ns_per_op << "," << mb_per_s << "," << realtime << endl;
+	} else {
+		cout << left << setw(26) << stage << setw(6) << param << right
+			<< setw(12) << r.ops << setw(14) << ns_per_op << setw(12) << mb_per_s
+			<< setw(12) << realtime << "  " << input << endl;
+	}
+}
+
+/**
+ * Decodes a file once with its PCM thrown away, so its setup is left
+ * unpacked in the decoder, then reopens it and gathers the audio packets of
+ * its first stream
+ * @param ov The decoder, already constructed on the file
+ * @param filename The file
+ * @param packets Set to the packets
+ * @param samples Set to the stream's length in samples, from its last
+ * granule position
+ * @return The number of packets
+ */
+static int gather_packets(VorbisDecoder &ov, char *filename, bench_packet **packets, long long *samples) {
+	delete ov.file;
+	ov.file = new BitFile(filename);
+	ov.have_stream = false;
+	ov.stream_ended = false;
+	ov.stream_started = false;
+	ov.known_serial_count = 0;
+	ov.page.segments = 0;
+	ov.page.packet.segment_offset = 0;
+
+	int count = 0;
+	int capacity = 256;
+	*packets = new bench_packet[capacity];
+	int headers = 0;
+	*samples = 0;
+	while (!ov.file->eof) {
+		ov.init_vorbis_packet();
+		if (ov.file->eof)
+			break;
+		if (ov.page.header_type & 0x02) {
+			if (headers > 0) // The next chain link
+				break;
+			ov.stream_serial = ov.page.bitstream_serial_number;
+			ov.have_stream = true;
+		}
+		if (ov.page.packet.continued) {
+			ov.skip_packet();
+			continue;
+		}
+		ov.assemble_packet();
+		if (ov.page.granule_position > *samples)
+			*samples = ov.page.granule_position;
+		if (headers++ < 3)
+			continue;
+
+		if (count == capacity) {
+			bench_packet *grown = new bench_packet[capacity * 2];
+			memcpy(grown, *packets, capacity * sizeof(bench_packet));
+			delete [] *packets;
+			*packets = grown;
+			capacity *= 2;
+		}
+		(*packets)[count].length = ov.page.packet.length;
+		(*packets)[count].data = new int[ov.page.packet.length];
+		memcpy((*packets)[count].data, ov.page.packet.data, ov.page.packet.length * sizeof(int));
+		count++;
+	}
+	return count;
+}
+
+/**
+ * Points the decoder's current packet at a gathered packet
+ * @param ov The decoder
+ * @param p The packet
+ */
+static void load_packet(VorbisDecoder &ov, bench_packet &p) {
+	ov.page.packet.data = p.data;
+	ov.page.packet.length = p.length;
+	ov.page.packet.bytepos = 0;
+	ov.page.packet.bitpos = 0;
+	ov.page.packet.end_of_packet = true;
+	ov.status = VORBIS_OK;
+}
+
+/** Pipeline stages that run on a file's packets */
+enum packet_stage {
+	STAGE_READBITS,
+	STAGE_SCALAR,
+	STAGE_VQ,
+	STAGE_FLOORS,
+	STAGE_RESIDUES,
+	STAGE_COUPLING
+};
+
+/**
+ * Runs one stage over a file's packets, in order and round again, for at
+ * least min_time
+ * @param ov The decoder with the file's setup unpacked
+ * @param packets The file's packets
+ * @param count Number of packets
+ * @param stage The stage to time
+ * @param residue_type For STAGE_RESIDUES, only time the submaps that use
+ * this residue type, counting each as an operation
+ * @param seconds_per_byte Seconds of audio per packet byte
+ * @return The result
+ */
+static bench_result run_stage(VorbisDecoder &ov, bench_packet *packets, int count, packet_stage stage, int residue_type, double seconds_per_byte) {
+	bench_result r;
+	r.ops = 0;
+	r.bytes = 0;
+	r.seconds = 0;
+
+	// Books to decode from packet bits: any book for scalar decode, and
+	// only books with a lookup table for VQ
+	int *books = new int[ov.info.vorbis_codebook_count];
+	int book_count = 0;
+	for (int i=0; i<ov.info.vorbis_codebook_count; i++) {
+		Codebook *c = &ov.info.codebook_config[i];
+		if (c->htree == NULL || c->htree->root == NULL || c->htree->root->entry != -1)
+			continue; // A single-entry book reads no bits
+		if (stage == STAGE_VQ && c->lookup_type == 0)
+			continue;
+		books[book_count++] = i;
+	}
+
+	// A stage much cheaper than the untimed ones ahead of it could take an
+	// age to add up to min_time, so the wall clock is limited too
+	int found = 0;
+	int passes = 0;
+	double started = now();
+	for (int i=0; count > 0 && (r.seconds < min_time || found == 0); i = (i+1) % count) {
+		if (i == 0 && passes++ > 0 && found == 0)
+			break; // Nothing in the file exercises this stage
+		if (found > 0 && now() - started > min_time * 20)
+			break;
+
+		bench_packet &p = packets[i];
+		load_packet(ov, p);
+		double t0 = 0;
+		long long ops = 1;
+		long long bytes = p.length;
+		double seconds = 0;
+
+		if (stage == STAGE_READBITS) {
+			ops = p.length * 8;
+			t0 = now();
+			for (long long j=0; j<ops; j++)
+				ov.readbits(1);
+		} else if (stage == STAGE_SCALAR || stage == STAGE_VQ) {
+			if (book_count == 0)
+				break;
+			int book = books[i % book_count];
+			ops = 0;
+			t0 = now();
+			if (stage == STAGE_SCALAR) {
+				while (ov.page.packet.bytepos < p.length && ov.status == VORBIS_OK) {
+					ov.decode_codebook_scalar(book);
+					ops++;
+				}
+			} else {
+				while (ov.page.packet.bytepos < p.length && ov.status == VORBIS_OK) {
+					delete [] ov.decode_codebook_VQ(book);
+					ops++;
+				}
+			}
+		} else {
+			ov.first_packet = false;
+			if (!ov.read_audio_header())
+				continue;
+
+			if (stage == STAGE_FLOORS)
+				t0 = now();
+			ov.decode_floors();
+			ov.audio.residue_out = NULL;
+			if (stage != STAGE_FLOORS) {
+				if (ov.status != VORBIS_OK || ov.audio.silent_frame) {
+					ov.free_packet_vectors();
+					continue;
+				}
+				int submaps = ov.audio.mapping->submaps;
+				int timed_submaps = 0;
+				for (int s=0; s<submaps; s++)
+					timed_submaps += (ov.info.vorbis_residue_types[ov.audio.mapping->submap_residue[s]] == residue_type);
+				if ((stage == STAGE_RESIDUES && timed_submaps == 0)
+						|| (stage == STAGE_COUPLING && ov.audio.mapping->coupling_steps == 0)) {
+					ov.free_packet_vectors();
+					continue;
+				}
+
+				ov.nonzero_vector_propagate();
+				if (stage == STAGE_RESIDUES) {
+					// The other types' submaps are decoded untimed, to get
+					// past their bits, and their bytes aren't counted
+					int *do_not_decode_flag = new int[ov.info.audio_channels];
+					for (int c=0; c<ov.info.audio_channels; c++)
+						do_not_decode_flag[c] = 0;
+					ov.audio.residue_out = new double*[ov.info.audio_channels];
+					ops = timed_submaps;
+					bytes = 0;
+					for (int s=0; s<submaps; s++) {
+						if (ov.info.vorbis_residue_types[ov.audio.mapping->submap_residue[s]] != residue_type) {
+							ov.decode_submap_residue(s, do_not_decode_flag);
+							continue;
+						}
+						long long start = ov.page.packet.bytepos;
+						t0 = now();
+						ov.decode_submap_residue(s, do_not_decode_flag);
+						seconds += now() - t0;
+						bytes += ov.page.packet.bytepos - start;
+					}
+					delete [] do_not_decode_flag;
+				} else
+					ov.decode_residues();
+				if (stage == STAGE_COUPLING) {
+					// Coupled pairs write their spectra as they go
+					ov.audio.spectrum = new int*[ov.out_channels];
+					for (int c=0; c<ov.out_channels; c++)
+						ov.audio.spectrum[c] = NULL;
+					t0 = now();
+					ov.inverse_coupling();
+				}
+			}
+		}
+		if (stage == STAGE_RESIDUES)
+			r.seconds += seconds;
+		else
+			r.seconds += now() - t0;
+
+		if (stage == STAGE_COUPLING) {
+			for (int c=0; c<ov.out_channels; c++)
+				delete [] ov.audio.spectrum[c];
+			delete [] ov.audio.spectrum;
+		}
+
+		if (stage >= STAGE_FLOORS)
+			ov.free_packet_vectors();
+		r.ops += ops;
+		r.bytes += bytes;
+		found++;
+	}
+	r.audio_seconds = r.bytes * seconds_per_byte;
+
+	ov.page.packet.data = NULL;
+	delete [] books;
+	return r;
+}
+
+/**
+ * Times the page layer (capture, header parse, CRC and demux) over a whole
+ * file, as many times as fit in min_time
+ * @param ov The decoder
+ * @param filename The file
+ * @param audio_seconds Length of the file's audio
+ * @return The result, with a page as the operation
+ */
+static bench_result run_pages(VorbisDecoder &ov, char *filename, double audio_seconds) {
+	bench_result r;
+	r.ops = 0;
+	r.bytes = 0;
+	r.seconds = 0;
+	r.audio_seconds = 0;
+
+	while (r.seconds < min_time) {
+		delete ov.file;
+		ov.file = new BitFile(filename);
+		// Our stream's pages get the full check; the BOS page is read
+		// as the start of a chain link
+		ov.have_stream = true;
+		ov.stream_ended = true;
+		ov.known_serial_count = 0;
+		long length = ov.file->length();
+
+		double t0 = now();
+		while (!ov.file->eof) {
+			if (ov.read_ogg_page())
+				r.ops++;
+		}
+		r.seconds += now() - t0;
+		r.bytes += length;
+		r.audio_seconds += audio_seconds;
+		if (length <= 0)
+			break;
+	}
+	return r;
+}
+
+/**
+ * Times mdct_backward and mdct_unroll_lap at every Vorbis blocksize, on
+ * spectra of noise
+ */
+static void run_transforms() {
+	const int rate = 44100;
+	for (int n=64; n<=8192; n*=2) {
+		DATA_TYPE *spectrum = new DATA_TYPE[n/2];
+		DATA_TYPE *in = new DATA_TYPE[n/2];
+		DATA_TYPE *right = new DATA_TYPE[n/4];
+		ogg_int16_t *out = new ogg_int16_t[n/2];
+		ogg_uint32_t seed = 12345;
+		for (int i=0; i<n/2; i++) {
+			seed = seed*1664525 + 1013904223;
+			spectrum[i] = (ogg_int32_t)(seed >> 8) - (1 << 23);
+		}
+		for (int i=0; i<n/4; i++)
+			right[i] = spectrum[i] >> 4;
+
+		bench_result r;
+		r.ops = 0;
+		r.seconds = 0;
+		while (r.seconds < min_time) {
+			memcpy(in, spectrum, n/2 * sizeof(DATA_TYPE));
+			double t0 = now();
+			mdct_backward(n, in);
+			r.seconds += now() - t0;
+			r.ops++;
+		}
+		r.bytes = r.ops * (n/2) * sizeof(DATA_TYPE);
+		r.audio_seconds = r.ops * (double)(n/2) / rate;
+		report("mdct_backward", "synthetic", n, r);
+
+		lap_descriptor laps[4];
+		mdct_lap_init(laps, n, n);
+		r.ops = 0;
+		double t0 = now();
+		do {
+			for (int i=0; i<64; i++)
+				mdct_unroll_lap(&laps[LAP_INDEX(1, 1)], in, right, out, 1, 0, n/2);
+			r.ops += 64;
+			r.seconds = now() - t0;
+		} while (r.seconds < min_time);
+		r.bytes = r.ops * (n/2) * sizeof(DATA_TYPE);
+		r.audio_seconds = r.ops * (double)(n/2) / rate;
+		report("mdct_unroll_lap", "synthetic", n, r);
+
+		delete [] spectrum;
+		delete [] in;
+		delete [] right;
+		delete [] out;
+	}
+}
+
+/**
+ * Runs every stage on a file
+ * @param filename The file
+ * @return False if it couldn't be decoded
+ */
+static bool bench_file(char *filename) {
+	NullPCMSink sink;
+	decode_options options;
+	memset(&options, 0, sizeof(options));
+	options.decimation = 1;
+	options.bits = 16;
+	options.sink = &sink;
+
+	VorbisDecoder ov(filename, &options);
+	cout << dec;
+	if (!ov.headers_ok) {
+		cerr << filename << ": couldn't decode" << endl;
+		return false;
+	}
+
+	bench_packet *packets;
+	long long samples;
+	int count = gather_packets(ov, filename, &packets, &samples);
+	delete [] ov.page.packet.data;
+	ov.page.packet.data = NULL;
+	double audio_seconds = (double)samples / ov.info.audio_sample_rate;
+	long long packet_bytes = 0;
+	for (int i=0; i<count; i++)
+		packet_bytes += packets[i].length;
+	double seconds_per_byte = (packet_bytes > 0 ? audio_seconds / packet_bytes : 0);
+
+	report("page_parse_crc", filename, 0, run_pages(ov, filename, audio_seconds));
+
+	// Replayed packets don't span pages
+	ov.file->eof = true;
+	report("readbits", filename, 1, run_stage(ov, packets, count, STAGE_READBITS, 0, seconds_per_byte));
+	report("decode_codebook_scalar", filename, 0, run_stage(ov, packets, count, STAGE_SCALAR, 0, seconds_per_byte));
+	report("decode_codebook_VQ", filename, 0, run_stage(ov, packets, count, STAGE_VQ, 0, seconds_per_byte));
+	report("decode_floors", filename, 1, run_stage(ov, packets, count, STAGE_FLOORS, 0, seconds_per_byte));
+	for (int type=0; type<3; type++) {
+		bool used = false;
+		for (int i=0; i<ov.info.vorbis_residue_count; i++)
+			used |= (ov.info.vorbis_residue_types[i] == type);
+		if (used)
+			report("decode_residues", filename, type, run_stage(ov, packets, count, STAGE_RESIDUES, type, seconds_per_byte));
+	}
+	report("inverse_coupling", filename, 0, run_stage(ov, packets, count, STAGE_COUPLING, 0, seconds_per_byte));
+
+	for (int i=0; i<count; i++)
+		delete [] packets[i].data;
+	delete [] packets;
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	char *first_file = NULL;
+	for (int i=1; i<argc; i++) {
+		if (strcmp(argv[i], "-t") == 0 && i+1 < argc) // Minimum seconds per stage
+			min_time = atof(argv[++i]);
+		else if (strcmp(argv[i], "-c") == 0) // CSV output
+			csv = true;
+		else if (first_file == NULL)
+			first_file = argv[i];
+	}
+
+	if (first_file == NULL) {
+		cerr << "Usage: " << argv[0] << " [-t min_seconds] [-c] file.ogg ..." << endl;
+		return 1;
+	}
+
+	if (csv)
+		cout << "stage,input,param,ops,ns_per_op,mb_per_s,realtime" << endl;
+	else
+		cout << left << setw(26) << "stage" << setw(6) << "param" << right
+			<< setw(12) << "ops" << setw(14) << "ns/op" << setw(12) << "MB/s"
+			<< setw(12) << "realtime" << "  input" << endl;
+
+	bool ok = true;
+	for (int i=1; i<argc; i++) {
+		if (strcmp(argv[i], "-t") == 0)
+			i++;
+		else if (strcmp(argv[i], "-c") != 0)
+			ok &= bench_file(argv[i]);
+	}
+
+	// The decoders above leave cout in hex
+	cout << dec;
+	run_transforms();
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,698 @@
+/***************************************************************************
+ *   Copyright (C) 2008 by Steve Heindel   *
+ *   stevenheindel@gmail.com   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef VORBISDECODER_H
+#define VORBISDECODER_H
+
+#include "oggvorbis.h"
+#include "packet.h"
+#include "codebook.h"
+#include "floor1.h"
+#include "residue.h"
+#include "mapping.h"
+#include "mode.h"
+#include "audio.h"
+#include "bitfile.h"
+#include "mdct.h"
+#include "resampler.h"
+
+typedef struct ogg_page {
+	/** Capture pattern */
+	int capture_pattern;
+	/** Version */
+	int version;
+	/** Header type */
+	int header_type;
+	/** Granule position */
+	long long granule_position;
+	/** Bitstream serial number */
+	int bitstream_serial_number;
+	/** Page sequence number */
+	int sequence_number;
+	/** CRC checksum */
+	int CRC_checksum;
+	/** Page segments */
+	int segments;
+	/** Segment table */
+	int *segment_table;
+	
+	/** Page data length */
+	int data_length;
+	/** Page data */
+	int *data;
+	
+	/** Vorbis packet */
+	Packet packet;
+} ogg_page;
+
+typedef struct vorbis_info {
+	/** Vorbis ID header - audio channels */
+	int audio_channels;
+	/** Vorbis ID header - audio sample rate */
+	int audio_sample_rate;
+	
+	/** Vorbis ID header - bitrate maximum */
+	int bitrate_maximum;
+	/** Vorbis ID header - bitrate nominal */
+	int bitrate_nominal;
+	/** Vorbis ID header - bitrate minimum */
+	int bitrate_minimum;
+	
+	/** Vorbis ID header - blocksize 0 */
+	int blocksize_0;
+	/** Vorbis ID header - blocksize 1 */
+	int blocksize_1;
+	
+	/** Vorbis comment header - the header's string bytes, which the vendor
+	 *  string and user comments below are slices of */
+	char *comment_data;
+	/** Vorbis comment header - vendor length */
+	int vendor_length;
+	/** Vorbis comment header - vendor string: UTF-8, not NUL terminated */
+	const char *vendor_string;
+	
+	/** Vorbis comment header - user comment list length (the comments kept) */
+	int user_comment_list_length;
+	/** Vorbis comment header - user comment length array */
+	int *user_comment_length;
+	/** Vorbis comment header - user comment array: UTF-8 "NAME=value", not
+	 *  NUL terminated */
+	const char **user_comment;
+	
+	/** Vorbis setup header - codebooks - codebook count */
+	int vorbis_codebook_count;
+	/** Vorbis setup header - codebooks - storage array */
+	Codebook *codebook_config;
+	
+	/** Vorbis setup header - time domain transforms - time count */
+	int vorbis_time_count;
+	
+	/** Vorbis setup header - floors - floor count */
+	int vorbis_floor_count;
+	/** Vorbis setup header - floors - floor types array */
+	int *vorbis_floor_types;
+	/** Vorbis setup header - floors - storage array */
+	Floor1 *floor_config;
+	
+	/** Vorbis setup header - residues - residue count */
+	int vorbis_residue_count;
+	/** Vorbis setup header - residues - residue types array */
+	int *vorbis_residue_types;
+	/** Vorbis setup header - residues - storage array */
+	Residue *residue_config;
+	
+	/** Vorbis setup header - mappings - mapping count */
+	int vorbis_mapping_count;
+	/** Vorbis setup header - mappings - storage array */
+	Mapping *mapping_config;
+	
+	/** Vorbis setup header - modes - mode count */
+	int vorbis_mode_count;
+	/** Vorbis setup header - modes - storage array */
+	Mode *mode_config;
+} vorbis_info;
+
+
+/**
+ * The decoder behind OggVorbis, with all of its state and stages open to
+ * the tools that time them. Decodes an Ogg/Vorbis file, chained streams and
+ * all, into a PCMSink. The whole decode runs in the constructor; the
+ * headers stay readable in info afterwards.
+ */
+class VorbisDecoder {
+public:
+	bool debug; // Set true to see debug info
+	bool warning; // Set true to see warnings (and errors recovered from)
+	
+	/** Status of the header or audio packet being decoded */
+	vorbis_status status;
+	/** The first error met anywhere in the file, or VORBIS_OK */
+	vorbis_status error;
+	
+	/** The file to read data from */
+	BitFile *file;
+	
+	/** Ogg page info */
+	ogg_page page;
+	/** Serial number of the chain link being decoded */
+	int stream_serial;
+	/** Has stream_serial been picked yet? */
+	bool have_stream;
+	/** Has the EOS page of stream_serial been read? */
+	bool stream_ended;
+	/** Has a page of stream_serial other than its BOS page been read? A
+	 *  link's BOS pages all come first, so a BOS page after this starts
+	 *  the next link, even if this one never got its EOS page */
+	bool stream_started;
+	/** Serial numbers of every logical stream a good BOS page has announced */
+	int *known_serials;
+	/** Number of known_serials in use */
+	int known_serial_count;
+	/** Size of known_serials */
+	int known_serial_capacity;
+	
+	/** Our header information: ID, comment, setup */
+	vorbis_info info;
+	
+	/** Caller's decode settings */
+	decode_options options;
+	
+	/** Vorbis audio decode storage */
+	Audio audio;
+	/** Is *audio an unpreceded audio packet? */
+	bool first_packet;
+	/** Were the current stream's headers all read successfully? */
+	bool headers_ok;
+	/** Length of the stream in samples, from its last page's granule
+	 *  position; -1 if unknown, as for a chain of more than one link.
+	 *  Only found when probing */
+	long long length_samples;
+	/** Has init_output() set up the output for a stream? */
+	bool output_ready;
+	
+	/** Number of channels synthesized and output */
+	int out_channels;
+	/** out_channels x audio_channels downmix gains, or NULL for none */
+	double *downmix;
+	
+	int **mdctright;
+	/** Is a channel's mdctright all zeros (its last frame was silent)? */
+	bool *mdctright_silent;
+	/** Overlap-add geometry for each previous and current block flag, at
+	 *  LAP_INDEX(lW, W); set up with the output */
+	lap_descriptor laps[4];
+	
+	/** Where decoded PCM goes */
+	PCMSink *sink;
+	/** Did we create the sink (and so have to delete it)? */
+	bool own_sink;
+	/** PCM waiting to be handed to the sink: interleaved, or one
+	 *  pcm_capacity sized plane per channel in planar mode */
+	char *pcmout;
+	/** Size of pcmout, in samples per channel */
+	int pcm_capacity;
+	/** Samples per channel currently in pcmout */
+	int pcm_fill;
+	/** Bytes per output sample: 2 for 16-bit, 4 for 24- and 32-bit */
+	int pcm_bytes;
+	/** Dither state for 16-bit output */
+	pcm_16_dither dither;
+	/** Set while ReplayGain boosts the current stream; the output then
+	 *  goes through a pcm_limit */
+	bool limiting;
+	/** The current stream's gain reduction in Q16, for pcm_limit */
+	ogg_int32_t limit_gain;
+	
+	/** Sample rate converter on the output, or NULL */
+	Resampler *resampler;
+	/** Lapped Q-format samples of one channel, ahead of the resampler */
+	ogg_int32_t *resample_in;
+	/** Resampled Q-format samples of one channel */
+	ogg_int32_t *resample_out;
+	
+	/** Raw bytes of the setup header the codebooks were unpacked from,
+	 *  or NULL before the first one */
+	int *setup_packet;
+	/** Length of setup_packet */
+	int setup_packet_length;
+	/** Channel count setup_packet was unpacked for */
+	int setup_channels;
+	
+	/** Scale from floor times residue to the IMDCT's input: 1/256, times
+	 *  the ReplayGain of the current stream */
+	double spectrum_scale;
+	
+#ifdef VORBIS_STATS
+	/** Decode counters and stage timings */
+	decode_stats stats;
+#endif
+	
+	/**
+	 * Constructor which sets off the Ogg/Vorbis decoding process
+	 * @param infile The file to read from
+	 * @param opts Decode settings, or NULL for a full decode
+	 */
+	VorbisDecoder(char *filename, decode_options *opts = NULL);
+	
+	/**
+	 * Frees the headers, which stay readable in info after decoding or
+	 * probing, and closes the file
+	 */
+	~VorbisDecoder();
+	
+	/**
+	 * Records an error that decoding can carry on from
+	 * @param code The kind of error
+	 * @param message What went wrong
+	 */
+	void report(vorbis_status code, const char *message);
+	
+	/**
+	 * Records an error in the header or audio packet being decoded; the
+	 * caller returns straight away and the packet is given up on
+	 * @param code The kind of error
+	 * @param message What went wrong
+	 */
+	void fail(vorbis_status code, const char *message);
+	
+	/**
+	 * Finds the stream length from the granule position of the file's last
+	 * page, searching back from the end of the file a block at a time (up
+	 * to 2 MB). Only the first chain link is measured, and only when it's
+	 * the file's last: a longer chain leaves the length unknown
+	 */
+	void find_length();
+	
+	/**
+	 * Reads the ID, comment and setup headers of a logical stream, starting
+	 * with the ID header packet already set up by init_vorbis_packet()
+	 */
+	void read_vorbis_headers();
+	
+	/**
+	 * Starts on a logical stream, the first or the next of a chained file,
+	 * whose ID header packet is the current one
+	 */
+	void start_stream();
+	
+	/**
+	 * Works out the linear ReplayGain of the current stream from its comment
+	 * header. Where the matching peak tag is given, the gain is held down so
+	 * the peak stays at full scale. A boost the peak tag doesn't rule out
+	 * (no tag, or a wrong one) is caught at the output by pcm_limit
+	 * @return The gain, or 1 if it's off or the stream isn't tagged
+	 */
+	double replaygain();
+	
+	/**
+	 * Reads a user comment's value as a number, e.g. "-6.52 dB"
+	 * @param name The field name
+	 * @param value Set to the number
+	 * @return False if there's no such field or it doesn't start with a number
+	 */
+	bool comment_number(const char *name, double *value);
+	
+	/**
+	 * Allocates the lapping and output state for the current stream layout
+	 */
+	void init_output();
+	
+	/**
+	 * Hands over the rest of the output and frees the output state
+	 */
+	void close_output();
+	
+	/**
+	 * Frees what init_output() and build_downmix() allocated
+	 */
+	void free_output();
+	
+	/**
+	 * Frees the comment header strings
+	 */
+	void free_comments();
+	
+	/**
+	 * Looks up a user comment by field name, which the Vorbis spec makes
+	 * case-insensitive ASCII. The comments are scanned on each call; nothing
+	 * is indexed up front
+	 * @param name The field name, e.g. "ARTIST" or "REPLAYGAIN_TRACK_GAIN"
+	 * @param length Set to the length of the value
+	 * @param index Which of the fields of that name to find (0 for the first)
+	 * @return The value, not NUL terminated, or NULL if there's no such field
+	 */
+	const char *comment(const char *name, int *length, int index = 0);
+	
+	/**
+	 * Frees the unpacked setup header: codebooks, floors, residues,
+	 * mappings and modes. A setup header that failed part way through
+	 * unpacking is freed as far as it got
+	 */
+	void free_setup();
+	
+	/**
+	 * Sets up out_channels and the downmix gains from the decode options
+	 */
+	void build_downmix();
+	
+	/**
+	 * Finds where a channel's next output sample goes in pcmout
+	 * @param channel The output channel
+	 * @param step Set to the distance between the channel's samples
+	 * @return The position of the channel's next sample
+	 */
+	char *pcm_channel_out(int channel, int *step);
+	
+	/**
+	 * Writes Q-format samples to the PCM buffer in the requested output format
+	 * @param in The samples
+	 * @param n The number of samples
+	 * @param out Where the first sample goes
+	 * @param step Distance between output samples
+	 */
+	void store_channel(const ogg_int32_t *in, int n, char *out, int step);
+	
+	/**
+	 * Pushes the end of the stream through the resampler's filter
+	 */
+	void drain_resampler();
+	
+	/**
+	 * Hands any buffered PCM over to the sink
+	 */
+	void flush_pcm();
+	
+	/**
+	 * Reads in the next page of the Vorbis stream, stepping over the pages
+	 * of any other logical streams multiplexed with it
+	 */
+	void read_ogg_header();
+	
+	/**
+	 * Reads in and verifies the ogg header; a bad page is dropped and the
+	 * next one found by resyncing to its capture pattern
+	 * @return False if the page was bad or belonged to another logical
+	 * stream, and so was skipped
+	 */
+	bool read_ogg_page();
+	
+	/**
+	 * Checks if a BOS page has announced a logical stream
+	 * @param serial The stream's serial number
+	 * @return True if it's one of known_serials
+	 */
+	bool is_known_serial(int serial);
+	
+	/**
+	 * Adds a logical stream to known_serials
+	 * @param serial The stream's serial number
+	 */
+	void add_known_serial(int serial);
+	
+	/**
+	 * Moves the file up to the next good page after sync was lost. Capture
+	 * pattern candidates are found a block at a time with memchr, and each
+	 * is only accepted once its header makes sense and its CRC checks out,
+	 * so "OggS" turning up inside packet data doesn't fool it
+	 * @return False if the file ended first
+	 */
+	bool resync();
+	
+	/**
+	 * Checks the page starting at the file's current position without
+	 * reading past it
+	 * @return True if it's a whole page with a good header and CRC
+	 */
+	bool page_at_cursor_valid();
+	
+	/**
+	 * Checks if the page starts with a Vorbis ID header packet
+	 * @return True if the page data begins with 0x01 "vorbis"
+	 */
+	bool is_vorbis_id_page();
+	
+	/**
+	 * When a new packet (or packet segment) is needed, this function will
+	 * set up the Packet structure accordingly
+	 */
+	void init_vorbis_packet();
+	
+	/**
+	 * Moves on to the next part of a page-spanning packet, on the next page
+	 * @return False if there is none: the file ended, or the next page
+	 * doesn't continue a packet because pages were lost. That page is then
+	 * left for init_vorbis_packet() to start on
+	 */
+	bool read_continuation_page();
+	
+	/**
+	 * Gathers the rest of a page-spanning packet, so that the whole packet
+	 * is in page.packet.data
+	 */
+	void assemble_packet();
+	
+	/**
+	 * Discards whatever is left of the current packet, including any
+	 * continuation on following pages
+	 */
+	void skip_packet();
+	
+	/**
+	 * Reads up to 32 of the next bits from the packet's data
+	 * @param bits The number of bits to read in
+	 * @return An int containing the bits in the order read from LSB to MSB
+	 */
+	int readbits(int bits);
+	
+	/**
+	 * Reads values in from the Vorbis ID header packet
+	 */
+	void read_vorbis_id_header();
+	
+	/**
+	 * Reads values in from the Vorbis comment header packet
+	 */
+	void read_vorbis_comment_header();
+	
+	
+	/**
+	 * Reads a string of the comment header, following the packet across
+	 * pages a run of bytes at a time
+	 * @param data The buffer to append to, reallocated as it fills
+	 * @param capacity Size of *data
+	 * @param used Bytes of *data in use
+	 * @param length Length of the string
+	 * @param keep False to skip over the string without storing it
+	 * @return False if the packet ended first
+	 */
+	bool read_comment_string(char **data, int *capacity, int *used, int length, bool keep);
+	
+	/**
+	 * Checks that a string is well-formed UTF-8: no stray continuation bytes,
+	 * overlong forms, surrogates or code points past U+10FFFF
+	 * @param s The string
+	 * @param length Its length
+	 * @return True if it's valid
+	 */
+	bool valid_utf8(const char *s, int length);
+	
+	/**
+	 * Calculates the base 2 logarithm of an integer in 2's complement
+	 * @param x The integer to find the log of
+	 * @return The log of x
+	 */
+	int ilog(int x);
+	
+	/**
+	 * Unpacks a Vorbis float32 into a native float32
+	 * @param x A Vorbis float32
+	 * @return The unpacked native float32
+	 */
+	float float32_unpack(int x);
+	
+	/**
+	 * Raises a number to an integral power
+	 * @param base The base number
+	 * @param exp The exponent to be raised to
+	 * @return Base raised to the exponent power
+	 */
+	int int32_pow(int base, int exp);
+	
+	/**
+	 * Computes the correct length of the value index for a
+	 * codebook VQ lookup table of lookup type 1
+	 * @param entries The number of entries in the codebook
+	 * @param dimensions The dimensions of the codebook
+	 * @return The correct length
+	 */
+	int lookup1_values(int entries, int dimensions);
+	
+	/**
+	 * Unpack codebooks
+	 */
+	void unpack_codebooks();
+	
+	/**
+	 * Unpack time domain transforms; this part of the format is unused in this version
+	 */
+	void unpack_time_domain_transforms();
+	
+	/**
+	 * Unpack floors
+	 */
+	void unpack_floors();
+	
+	/**
+	 * Unpack residues
+	 */
+	void unpack_residues();
+	
+	/**
+	 * Unpack mappings
+	 */
+	void unpack_mappings();
+	
+	/**
+	 * Unpack modes
+	 */
+	void unpack_modes();
+	
+	/**
+	 * Reads values in from the Vorbis setup header packet
+	 */
+	void read_vorbis_setup_header();
+	
+	/**
+	 * Read bits in and find the entry corresponding to the bit pattern
+	 * @param book The codebook to search
+	 * @return The entry corresponding to the first recognized bit pattern
+	 */
+	int decode_codebook_scalar(int book);
+	
+	/**
+	 * Reads past codewords whose vectors are not needed
+	 * @param book The codebook to use
+	 * @param count The number of codewords to consume
+	 */
+	void skip_codebook_VQ(int book, int count);
+	
+	/**
+	 * Decodes a vector from the bitstream
+	 * @param book The codebook to use
+	 * @return A vector of the constructed values
+	 */
+	double *decode_codebook_VQ(int book);
+	
+	/**
+	 * Finds the position n in vector [v] of the greatest value scalar element for which
+	 * n is less than [x] and vector [v] element n is less than vector [v] element [x]
+	 * @param v The vector to search
+	 * @param x The position to compare to
+	 * @return The low neighbor position
+	 */
+	int low_neighbor(int *v, int x);
+	
+	/**
+	 * Finds the position n in vector [v] of the lowest value scalar element for which n
+	 * is less than [x] and vector [v] element n is greater than vector [v] element [x]
+	 * @param v The vector to search
+	 * @param x The position to compare to
+	 * @return The high neighbor position
+	 */
+	int high_neighbor(int *v, int x);
+	
+	/**
+	 * Finds the Y value at point X along the line specified by x0, x1, y0 and y1; this function
+	 * uses an integer algorithm to solve for the point directly without calculating intervening
+	 * values along the line.
+	 * @param x0
+	 * @param y0
+	 * @param x1
+	 * @param y1
+	 * @param X
+	 * @return 
+	 */
+	int render_point(int x0, int y0, int x1, int y1, int X);
+	
+	void render_line(int x0, int y0, int x1, int y1, int* v);
+	
+	/**
+	 * Floor decode and synthesis
+	 */
+	void decode_floors();
+	
+	/**
+	 * Residue decode
+	 */
+	void decode_residues();
+	
+	/**
+	 * Residue decode of one submap, into audio.residue_out for the
+	 * submap's channels; decode_residues runs it on each in turn
+	 * @param submap The submap
+	 * @param do_not_decode_flag Scratch space, one int per channel
+	 */
+	void decode_submap_residue(int submap, int *do_not_decode_flag);
+	
+	/**
+	 * Matches up the magnitude and angle channels of each coupling step: if
+	 * either one has residue, both get decoded
+	 */
+	void nonzero_vector_propagate();
+	
+	/**
+	 * Turns each coupled magnitude/angle residue pair back into its two
+	 * channels. Without a downmix, a pair that's final after its step goes
+	 * straight to audio.spectrum, fused with the floor dot product.
+	 */
+	void inverse_coupling();
+	
+	/**
+	 * Allocates a spectrum vector for this frame, zeroed past spectrum_limit
+	 * @return The vector (audio.n/2 ints)
+	 */
+	int *new_spectrum();
+	
+	/**
+	 * Dot product mixed straight down to the output channels. The IMDCT is
+	 * linear, so mixing spectra equals mixing PCM, but only out_channels
+	 * transforms and overlaps are left to do.
+	 */
+	void downmix_spectrum();
+	
+	/**
+	 * Overlap-adds a channel's IMDCT output into the PCM buffer in the
+	 * requested output format
+	 * @param channel The channel to unroll
+	 * @param lap Overlap geometry of the previous and current blocks
+	 * @param out Where the channel's first sample goes
+	 * @param step Distance between the channel's samples
+	 * @param start First sample of the frame to output
+	 * @param end One past the last sample of the frame to output
+	 */
+	void unroll_channel(int channel, const lap_descriptor *lap, char *out, int step, int start, int end);
+	
+	void imdct(int *in, int n);
+	
+	/**
+	 * Stands silence in for the audio packet being decoded after an error in
+	 * its floors or residue, so it still takes up its place in time
+	 */
+	void conceal_packet();
+	
+	/**
+	 * Reads an audio packet's type, mode and window flags, and works out
+	 * its blocksize and windows
+	 * @return False if it isn't an audio packet we can decode
+	 */
+	bool read_audio_header();
+	
+	/**
+	 * Frees a decoded packet's floor and residue vectors and flags
+	 */
+	void free_packet_vectors();
+	
+	/**
+	 * Decode an audio packet
+	 */
+	void decode_audio();
+};
+
+#endif
@@ -0,0 +1,842 @@
+/***************************************************************************
+ *   Copyright (C) 2008 by Steve Heindel   *
+ *   stevenheindel@gmail.com   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * Writes synthetic Ogg/Vorbis streams for stress tests and benchmarks. The
+ * setup header is built from the options: one floor 1 per blocksize, a
+ * residue of the chosen type, and a short and a long mode. The audio
+ * packets are random codewords that follow the spec's decode order
+ * exactly, so each one is a well-formed packet of noise. The same seed
+ * always gives the same stream.
+ *
+ * Codebooks have a power of two entries, all the same codeword length, so
+ * entry e is coded as e in that many bits.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+
+#include "CRC_lookup_table.h"
+
+using namespace std;
+
+/** Settings for a generated stream */
+typedef struct gen_options {
+	/** Audio channels, 1 to 255 */
+	int channels;
+	/** Sample rate */
+	int rate;
+	/** Short and long blocksizes, powers of two from 256 to 8192 */
+	int blocksize_0;
+	int blocksize_1;
+	/** Block sequence: 'r'andom, 'l'ong, 's'hort or 'a'lternating */
+	char blocks;
+	/** log2 of the residue VQ codebook's entries */
+	int vq_bits;
+	/** Residue VQ codebook dimensions */
+	int vq_dimensions;
+	/** Residue classifications, 2 to 64 */
+	int classifications;
+	/** Residue type: 0, 1 or 2 */
+	int residue_type;
+	/** Floor 1 partitions, 1 to 31 */
+	int floor_partitions;
+	/** Unused codebooks added to the setup header (up to 253), for
+	 *  setup-time tests */
+	int extra_books;
+	/** Write codeword lengths in the length-ordered form */
+	bool ordered;
+	/** Percent of channel frames that are silent (floor unused) */
+	int silence;
+	/** Residue amplitude, as log2 of the largest VQ value */
+	int amplitude;
+	/** Target page body size in bytes */
+	int page_bytes;
+	/** Chain links, each a whole stream with its own serial number */
+	int links;
+	/** Give every other chain link a different codebook, so the setup
+	 *  header changes from link to link */
+	bool vary_setup;
+	/** Seconds of audio per link */
+	double seconds;
+	/** Random seed */
+	unsigned int seed;
+} gen_options;
+
+/**
+ * Packs bits LSB first, the way Vorbis packets are read
+ */
+class BitWriter {
+	public:
+		unsigned char *data;
+		int capacity;
+		/** Bytes started */
+		int length;
+		/** Bits used of the last byte, 0 if it's full or there is none */
+		int bitpos;
+		
+		BitWriter() {
+			capacity = 4096;
+			data = new unsigned char[capacity];
+			length = 0;
+			bitpos = 0;
+		}
+		
+		~BitWriter() {
+			delete [] data;
+		}
+		
+		/**
+		 * Appends the low bits of a value, least significant first
+		 * @param value The value
+		 * @param bits How many bits to write, up to 32
+		 */
+		void write(unsigned int value, int bits) {
+			for (int i=0; i<bits; i++) {
+				if (bitpos == 0) {
+					if (length == capacity) {
+						unsigned char *grown = new unsigned char[capacity * 2];
+						memcpy(grown, data, length);
+						delete [] data;
+						data = grown;
+						capacity *= 2;
+					}
+					data[length++] = 0;
+				}
+				data[length-1] |= ((value >> i) & 1) << bitpos;
+				bitpos = (bitpos + 1) & 7;
+			}
+		}
+		
+		/**
+		 * Appends a Huffman codeword, most significant bit first: the order
+		 * the decoder walks the tree in
+		 * @param codeword The codeword
+		 * @param bits Its length
+		 */
+		void write_codeword(unsigned int codeword, int bits) {
+			for (int i=bits-1; i>=0; i--)
+				write((codeword >> i) & 1, 1);
+		}
+};
+
+/**
+ * Splits packets into pages of one logical stream
+ */
+class OggWriter {
+	public:
+		FILE *out;
+		int serial;
+		int sequence;
+		/** Target page body size */
+		int page_bytes;
+		
+		/** The page being built */
+		unsigned char segments[255];
+		int segment_count;
+		unsigned char *body;
+		int body_length;
+		/** Does the page start with the rest of a packet? */
+		bool continued;
+		/** Granule position of the last packet finished on the page, or -1 */
+		long long granule;
+		
+		OggWriter(FILE *setout, int setserial, int setpage_bytes) {
+			out = setout;
+			serial = setserial;
+			sequence = 0;
+			page_bytes = setpage_bytes;
+			segment_count = 0;
+			body = new unsigned char[255 * 255];
+			body_length = 0;
+			continued = false;
+			granule = -1;
+		}
+		
+		~OggWriter() {
+			delete [] body;
+		}
+		
+		/**
+		 * Adds a packet, starting a new page whenever the current one is full
+		 * @param data The packet
+		 * @param length Its length in bytes
+		 * @param granule_after Granule position at the end of the packet
+		 */
+		void packet(const unsigned char *data, int length, long long granule_after) {
+			int pos = 0;
+			while (true) {
+				if (segment_count == 255 || (segment_count > 0 && body_length >= page_bytes)) {
+					flush(false);
+					continued = (pos > 0);
+				}
+				
+				int lace = length - pos;
+				if (lace > 255)
+					lace = 255;
+				segments[segment_count++] = lace;
+				memcpy(body + body_length, data + pos, lace);
+				body_length += lace;
+				pos += lace;
+				
+				// A lacing value under 255 ends the packet
+				if (lace < 255) {
+					granule = granule_after;
+					return;
+				}
+			}
+		}
+		
+		/**
+		 * Writes out the current page
+		 * @param eos Mark it as the last page of the stream
+		 */
+		void flush(bool eos) {
+			unsigned char header[27];
+			memcpy(header, "OggS", 4);
+			header[4] = 0;
+			header[5] = (continued ? 0x01 : 0) | (sequence == 0 ? 0x02 : 0) | (eos ? 0x04 : 0);
+			for (int i=0; i<8; i++)
+				header[6 + i] = (unsigned char)((unsigned long long)granule >> (i*8));
+			for (int i=0; i<4; i++) {
+				header[14 + i] = (unsigned char)(serial >> (i*8));
+				header[18 + i] = (unsigned char)(sequence >> (i*8));
+				header[22 + i] = 0;
+			}
+			header[26] = segment_count;
+			
+			unsigned int crc = 0;
+			crc = update_crc(crc, header, 27);
+			crc = update_crc(crc, segments, segment_count);
+			crc = update_crc(crc, body, body_length);
+			for (int i=0; i<4; i++)
+				header[22 + i] = (unsigned char)(crc >> (i*8));
+			
+			fwrite(header, 1, 27, out);
+			fwrite(segments, 1, segment_count, out);
+			fwrite(body, 1, body_length, out);
+			
+			sequence++;
+			segment_count = 0;
+			body_length = 0;
+			continued = false;
+			granule = -1;
+		}
+	
+	private:
+		static unsigned int update_crc(unsigned int crc, const unsigned char *data, int length) {
+			for (int i=0; i<length; i++)
+				crc = (crc << 8) ^ CRC_lookup[((crc >> 24) & 0xFF) ^ data[i]];
+			return crc;
+		}
+};
+
+/**
+ * Builds a stream's headers and audio packets from its options
+ */
+class VorbisGenerator {
+	public:
+		gen_options options;
+		
+		/** Random generator state */
+		unsigned int seed;
+		
+		/** Codebook numbers */
+		enum { FLOOR_BOOK = 0, CLASS_BOOK = 1, VQ_BOOK = 2 };
+		
+		/** log2 of the floor book's entries; they must stay below the
+		 *  floor range (64 at the least) */
+		static const int floor_bits = 5;
+		/** Floor 1 multiplier and the Y range it gives */
+		static const int floor_multiplier = 2;
+		static const int floor_range = 128;
+		/** Floor 1 class dimension */
+		int floor_dimensions;
+		
+		/** Residue classbook: classifications per codeword, and log2 of its entries */
+		int classwords;
+		int class_bits;
+		/** Residue VQ book values per dimension (lookup type 1) */
+		int lookup_values;
+		/** Residue partition size */
+		int partition_size;
+		
+		VorbisGenerator(const gen_options &setoptions) {
+			options = setoptions;
+			seed = options.seed;
+			
+			// Up to 63 floor points between the two ends
+			floor_dimensions = 63 / options.floor_partitions;
+			if (floor_dimensions > 8)
+				floor_dimensions = 8;
+			
+			// As many classifications per classbook codeword as keep the
+			// book to 4096 entries
+			classwords = 1;
+			while (classwords < 8 && power(options.classifications, classwords + 1) <= 4096)
+				classwords++;
+			class_bits = 0;
+			while ((1 << class_bits) < power(options.classifications, classwords))
+				class_bits++;
+			
+			lookup_values = 0;
+			while (power(lookup_values + 1, options.vq_dimensions) <= (1 << options.vq_bits))
+				lookup_values++;
+			
+			partition_size = options.vq_dimensions * ((32 + options.vq_dimensions - 1) / options.vq_dimensions);
+		}
+		
+		/** A random number from 0 to n-1 */
+		unsigned int random(unsigned int n) {
+			seed = seed*1664525 + 1013904223;
+			return (seed >> 8) % n;
+		}
+		
+		static int power(int base, int exp) {
+			long long result = 1;
+			for (int i=0; i<exp; i++) {
+				result *= base;
+				if (result > 0x7fffffff)
+					return 0x7fffffff;
+			}
+			return (int)result;
+		}
+		
+		/** Number of bits to hold x, as the spec's ilog() */
+		static int ilog(unsigned int x) {
+			int bits = 0;
+			while (x > 0) {
+				bits++;
+				x >>= 1;
+			}
+			return bits;
+		}
+		
+		/**
+		 * Writes the ID header
+		 * @param w Where to
+		 */
+		void id_header(BitWriter &w) {
+			w.write(0x01, 8);
+			for (const char *c = "vorbis"; *c; c++)
+				w.write(*c, 8);
+			w.write(0, 32); // Version
+			w.write(options.channels, 8);
+			w.write(options.rate, 32);
+			w.write(0, 32); // Bitrate maximum
+			w.write(options.channels * 64000, 32); // Bitrate nominal
+			w.write(0, 32); // Bitrate minimum
+			w.write(ilog(options.blocksize_0) - 1, 4);
+			w.write(ilog(options.blocksize_1) - 1, 4);
+			w.write(1, 1); // Framing
+		}
+		
+		/**
+		 * Writes the comment header
+		 * @param w Where to
+		 */
+		void comment_header(BitWriter &w) {
+			const char *vendor = "PortableVorbis synthetic stream";
+			const char *comment = "TITLE=Synthetic noise";
+			w.write(0x03, 8);
+			for (const char *c = "vorbis"; *c; c++)
+				w.write(*c, 8);
+			w.write(strlen(vendor), 32);
+			for (const char *c = vendor; *c; c++)
+				w.write(*c, 8);
+			w.write(1, 32);
+			w.write(strlen(comment), 32);
+			for (const char *c = comment; *c; c++)
+				w.write(*c, 8);
+			w.write(1, 1); // Framing
+		}
+		
+		/**
+		 * Writes a codebook whose entries all have the same codeword length
+		 * @param w Where to
+		 * @param dimensions Values per entry
+		 * @param bits log2 of the number of entries
+		 * @param lookup Give it a lookup type 1 VQ table
+		 */
+		void codebook(BitWriter &w, int dimensions, int bits, bool lookup) {
+			int entries = 1 << bits;
+			w.write(0x564342, 24); // Sync pattern
+			w.write(dimensions, 16);
+			w.write(entries, 24);
+			if (options.ordered) {
+				w.write(1, 1);
+				w.write(bits - 1, 5);
+				w.write(entries, ilog(entries));
+			} else {
+				w.write(0, 1);
+				w.write(0, 1); // Not sparse
+				for (int i=0; i<entries; i++)
+					w.write(bits - 1, 5);
+			}
+			
+			if (!lookup) {
+				w.write(0, 4);
+				return;
+			}
+			
+			// Values from -(lookup_values/2) up in steps of the delta, packed
+			// as Vorbis floats: mantissa * 2^(exponent - 788). The delta is
+			// picked so the largest value is about 2^amplitude.
+			int values = 0;
+			while (power(values + 1, dimensions) <= entries)
+				values++;
+			int shift = options.amplitude - (ilog(values) - 1);
+			unsigned int exponent = 788 + (shift > 0 ? shift : 0);
+			w.write(1, 4);
+			w.write(0x80000000 | (exponent << 21) | (values / 2), 32); // Minimum
+			w.write((exponent << 21) | 1, 32); // Delta
+			int value_bits = (values > 1 ? ilog(values - 1) : 1);
+			w.write(value_bits - 1, 4);
+			w.write(0, 1); // sequence_p
+			for (int i=0; i<values; i++)
+				w.write(i, value_bits);
+		}
+		
+		/**
+		 * Writes a floor 1 for one blocksize
+		 * @param w Where to
+		 * @param blocksize The blocksize it's for
+		 */
+		void floor(BitWriter &w, int blocksize) {
+			int rangebits = ilog(blocksize/2) - 1;
+			w.write(1, 16); // Type
+			w.write(options.floor_partitions, 5);
+			for (int i=0; i<options.floor_partitions; i++)
+				w.write(0, 4); // All in class 0
+			w.write(floor_dimensions - 1, 3);
+			w.write(0, 2); // No subclasses, so no masterbook
+			w.write(FLOOR_BOOK + 1, 8);
+			w.write(floor_multiplier - 1, 2);
+			w.write(rangebits, 4);
+			
+			// Evenly spread, distinct X values inside (0, 2^rangebits)
+			int points = options.floor_partitions * floor_dimensions;
+			for (int i=0; i<points; i++)
+				w.write((int)((long long)(i + 1) * (1 << rangebits) / (points + 1)), rangebits);
+		}
+		
+		/**
+		 * Writes the residue: classification 0 is left empty, the others
+		 * code a pass with the VQ book, and the last one a second pass too
+		 * @param w Where to
+		 */
+		void residue(BitWriter &w) {
+			int end = options.blocksize_1 / 2;
+			if (options.residue_type == 2)
+				end *= options.channels;
+			
+			w.write(options.residue_type, 16);
+			w.write(0, 24); // Begin
+			w.write(end, 24);
+			w.write(partition_size - 1, 24);
+			w.write(options.classifications - 1, 6);
+			w.write(CLASS_BOOK, 8);
+			for (int i=0; i<options.classifications; i++) {
+				w.write(cascade(i), 3);
+				w.write(0, 1);
+			}
+			for (int i=0; i<options.classifications; i++) {
+				for (int pass=0; pass<8; pass++) {
+					if ((cascade(i) >> pass) & 1)
+						w.write(VQ_BOOK, 8);
+				}
+			}
+		}
+		
+		/** Passes coded for a residue classification */
+		int cascade(int classification) {
+			if (classification == 0)
+				return 0;
+			if (classification == options.classifications - 1 && options.classifications > 2)
+				return 3;
+			return 1;
+		}
+		
+		/**
+		 * Writes a mapping: one submap, with channels coupled in pairs
+		 * @param w Where to
+		 * @param floor_number Its floor
+		 */
+		void mapping(BitWriter &w, int floor_number) {
+			w.write(0, 16); // Type
+			w.write(0, 1); // One submap
+			int steps = options.channels / 2;
+			if (steps > 0) {
+				w.write(1, 1);
+				w.write(steps - 1, 8);
+				for (int i=0; i<steps; i++) {
+					w.write(i*2, ilog(options.channels - 1));
+					w.write(i*2 + 1, ilog(options.channels - 1));
+				}
+			} else
+				w.write(0, 1);
+			w.write(0, 2); // Reserved
+			w.write(0, 8); // Time
+			w.write(floor_number, 8);
+			w.write(0, 8); // Residue
+		}
+		
+		/**
+		 * Writes the setup header
+		 * @param w Where to
+		 */
+		void setup_header(BitWriter &w) {
+			w.write(0x05, 8);
+			for (const char *c = "vorbis"; *c; c++)
+				w.write(*c, 8);
+			
+			w.write(3 + options.extra_books - 1, 8);
+			codebook(w, 1, floor_bits, false);
+			codebook(w, classwords, class_bits, false);
+			codebook(w, options.vq_dimensions, options.vq_bits, true);
+			for (int i=0; i<options.extra_books; i++)
+				codebook(w, options.vq_dimensions, options.vq_bits, true);
+			
+			w.write(0, 6); // One time domain transform
+			w.write(0, 16);
+			
+			w.write(1, 6); // Two floors
+			floor(w, options.blocksize_0);
+			floor(w, options.blocksize_1);
+			
+			w.write(0, 6); // One residue
+			residue(w);
+			
+			w.write(1, 6); // Two mappings, one per blocksize
+			mapping(w, 0);
+			mapping(w, 1);
+			
+			w.write(1, 6); // Two modes
+			for (int i=0; i<2; i++) {
+				w.write(i, 1); // Block flag
+				w.write(0, 16);
+				w.write(0, 16);
+				w.write(i, 8); // Mapping
+			}
+			w.write(1, 1); // Framing
+		}
+		
+		/**
+		 * Writes an audio packet of random codewords
+		 * @param w Where to
+		 * @param long_block Is it a long block?
+		 * @param previous_long Is the block before it long?
+		 * @param next_long Is the block after it long?
+		 */
+		void audio_packet(BitWriter &w, bool long_block, bool previous_long, bool next_long) {
+			int channels = options.channels;
+			int n = (long_block ? options.blocksize_1 : options.blocksize_0);
+			
+			w.write(0, 1); // Audio
+			w.write(long_block ? 1 : 0, 1); // Mode
+			if (long_block) {
+				w.write(previous_long ? 1 : 0, 1);
+				w.write(next_long ? 1 : 0, 1);
+			}
+			
+			// Floors
+			bool *decode = new bool[channels];
+			int y_bits = ilog(floor_range - 1);
+			for (int c=0; c<channels; c++) {
+				decode[c] = ((int)random(100) >= options.silence);
+				w.write(decode[c] ? 1 : 0, 1);
+				if (!decode[c])
+					continue;
+				w.write(floor_range*3/4 + random(floor_range/4), y_bits);
+				w.write(floor_range*3/4 + random(floor_range/4), y_bits);
+				for (int i=0; i<options.floor_partitions * floor_dimensions; i++)
+					w.write_codeword(random(1 << floor_bits), floor_bits);
+			}
+			
+			// Coupled channels are decoded if either one is
+			for (int i=0; i<channels/2; i++) {
+				if (decode[i*2] || decode[i*2 + 1])
+					decode[i*2] = decode[i*2 + 1] = true;
+			}
+			
+			// Residue; type 2 is one interleaved vector of all the channels
+			bool any = false;
+			for (int c=0; c<channels; c++)
+				any |= decode[c];
+			int vectors = channels;
+			int size = n/2;
+			if (options.residue_type == 2) {
+				vectors = 1;
+				size *= channels;
+				decode[0] = any;
+			}
+			if (any)
+				residue_packet(w, decode, vectors, size);
+			
+			delete [] decode;
+		}
+		
+		/**
+		 * Writes the residue part of an audio packet, in the spec's order
+		 * @param w Where to
+		 * @param decode Which vectors are coded
+		 * @param vectors Number of vectors
+		 * @param size Length of each vector
+		 */
+		void residue_packet(BitWriter &w, bool *decode, int vectors, int size) {
+			int end = options.blocksize_1 / 2;
+			if (options.residue_type == 2)
+				end *= options.channels;
+			if (end > size)
+				end = size;
+			int partitions = end / partition_size;
+			
+			int **classes = new int*[vectors];
+			for (int v=0; v<vectors; v++) {
+				classes[v] = new int[partitions + classwords];
+				for (int i=0; i<partitions + classwords; i++)
+					classes[v][i] = random(options.classifications);
+			}
+			
+			for (int pass=0; pass<8; pass++) {
+				int partition = 0;
+				while (partition < partitions) {
+					if (pass == 0) {
+						for (int v=0; v<vectors; v++) {
+							if (!decode[v])
+								continue;
+							int entry = 0;
+							for (int i=0; i<classwords; i++)
+								entry = entry * options.classifications + classes[v][partition + i];
+							w.write_codeword(entry, class_bits);
+						}
+					}
+					
+					for (int i=0; i<classwords && partition < partitions; i++) {
+						for (int v=0; v<vectors; v++) {
+							if (!decode[v] || !((cascade(classes[v][partition]) >> pass) & 1))
+								continue;
+							for (int j=0; j<partition_size / options.vq_dimensions; j++)
+								w.write_codeword(random(1 << options.vq_bits), options.vq_bits);
+						}
+						partition++;
+					}
+				}
+			}
+			
+			for (int v=0; v<vectors; v++)
+				delete [] classes[v];
+			delete [] classes;
+		}
+		
+		/**
+		 * Writes one whole logical stream
+		 * @param out Where to
+		 * @param serial Its serial number
+		 */
+		void stream(FILE *out, int serial) {
+			OggWriter ogg(out, serial, options.page_bytes);
+			
+			// Each header starts a page, and the audio starts a new page
+			BitWriter id;
+			id_header(id);
+			ogg.packet(id.data, id.length, 0);
+			ogg.flush(false);
+			
+			BitWriter comment;
+			comment_header(comment);
+			ogg.packet(comment.data, comment.length, 0);
+			BitWriter setup;
+			setup_header(setup);
+			ogg.packet(setup.data, setup.length, 0);
+			ogg.flush(false);
+			
+			// The block sequence, decided a packet ahead for the window flags
+			long long samples = (long long)(options.seconds * options.rate);
+			long long granule = 0;
+			bool previous_long = false;
+			bool current_long = next_block(false, 0);
+			int previous_n = 0;
+			for (int i=0; granule < samples || i < 2; i++) {
+				bool next_long = next_block(current_long, i + 1);
+				int n = (current_long ? options.blocksize_1 : options.blocksize_0);
+				if (i > 0)
+					granule += previous_n/4 + n/4;
+				
+				BitWriter audio;
+				audio_packet(audio, current_long, previous_long, next_long);
+				ogg.packet(audio.data, audio.length, granule);
+				
+				previous_long = current_long;
+				current_long = next_long;
+				previous_n = n;
+			}
+			ogg.flush(true);
+		}
+		
+		/**
+		 * Picks a block's size
+		 * @param previous_long Was the last block long?
+		 * @param index The block's number in the stream
+		 * @return True for a long block
+		 */
+		bool next_block(bool previous_long, int index) {
+			switch (options.blocks) {
+				case 'l': return true;
+				case 's': return false;
+				case 'a': return (index & 1) == 1;
+				default: return random(4) == 0 ? !previous_long : previous_long;
+			}
+		}
+};
+
+/** Checks that a blocksize is a power of two from 256 to 8192 */
+static bool legal_blocksize(int n) {
+	for (int i=8; i<14; i++) {
+		if (n == (1 << i))
+			return true;
+	}
+	return false;
+}
+
+int main(int argc, char *argv[])
+{
+	gen_options options;
+	options.channels = 2;
+	options.rate = 44100;
+	options.blocksize_0 = 256;
+	options.blocksize_1 = 2048;
+	options.blocks = 'r';
+	options.vq_bits = 8;
+	options.vq_dimensions = 4;
+	options.classifications = 4;
+	options.residue_type = -1;
+	options.floor_partitions = 8;
+	options.extra_books = 0;
+	options.ordered = false;
+	options.silence = 5;
+	options.amplitude = 27;
+	options.page_bytes = 4096;
+	options.links = 1;
+	options.vary_setup = false;
+	options.seconds = 10;
+	options.seed = 1;
+	
+	char *filename = NULL;
+	for (int i=1; i<argc; i++) {
+		if (strcmp(argv[i], "-c") == 0 && i+1 < argc) // Channels
+			options.channels = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-r") == 0 && i+1 < argc) // Sample rate
+			options.rate = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-b0") == 0 && i+1 < argc) // Short blocksize
+			options.blocksize_0 = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-b1") == 0 && i+1 < argc) // Long blocksize
+			options.blocksize_1 = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-m") == 0 && i+1 < argc) // Block sequence
+			options.blocks = argv[++i][0];
+		else if (strcmp(argv[i], "-e") == 0 && i+1 < argc) // log2 VQ book entries
+			options.vq_bits = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-D") == 0 && i+1 < argc) // VQ book dimensions
+			options.vq_dimensions = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-C") == 0 && i+1 < argc) // Residue classifications
+			options.classifications = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-t") == 0 && i+1 < argc) // Residue type
+			options.residue_type = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-f") == 0 && i+1 < argc) // Floor partitions
+			options.floor_partitions = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-x") == 0 && i+1 < argc) // Extra codebooks
+			options.extra_books = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-O") == 0) // Length-ordered codebooks
+			options.ordered = true;
+		else if (strcmp(argv[i], "-z") == 0 && i+1 < argc) // Percent silent channel frames
+			options.silence = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-a") == 0 && i+1 < argc) // log2 residue amplitude
+			options.amplitude = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-p") == 0 && i+1 < argc) // Page size
+			options.page_bytes = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-l") == 0 && i+1 < argc) // Chain links
+			options.links = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-V") == 0) // Change the setup header between links
+			options.vary_setup = true;
+		else if (strcmp(argv[i], "-s") == 0 && i+1 < argc) // Seconds per link
+			options.seconds = atof(argv[++i]);
+		else if (strcmp(argv[i], "-S") == 0 && i+1 < argc) // Random seed
+			options.seed = strtoul(argv[++i], NULL, 0);
+		else
+			filename = argv[i];
+	}
+	if (options.residue_type < 0)
+		options.residue_type = (options.channels > 1 ? 2 : 1);
+	
+	const char *problem = NULL;
+	if (options.channels < 1 || options.channels > 255)
+		problem = "channels must be 1 to 255";
+	else if (!legal_blocksize(options.blocksize_0) || !legal_blocksize(options.blocksize_1) || options.blocksize_0 > options.blocksize_1)
+		problem = "blocksizes must be powers of two from 256 to 8192, short <= long";
+	else if (options.vq_bits < 1 || options.vq_bits > 20 || options.vq_dimensions < 1 || options.vq_dimensions > options.vq_bits)
+		problem = "VQ book needs 1 to 20 entry bits and 1 to that many dimensions";
+	else if (options.classifications < 2 || options.classifications > 64)
+		problem = "classifications must be 2 to 64";
+	else if (options.residue_type < 0 || options.residue_type > 2)
+		problem = "residue type must be 0, 1 or 2";
+	else if (options.floor_partitions < 1 || options.floor_partitions > 31)
+		problem = "floor partitions must be 1 to 31";
+	else if (options.extra_books < 0 || options.extra_books > 253 - (options.vary_setup ? 1 : 0))
+		problem = "at most 253 extra codebooks";
+	else if (options.silence < 0 || options.silence > 100 || options.amplitude < 0 || options.amplitude > 30)
+		problem = "silence is a percentage, amplitude 0 to 30";
+	else if (options.page_bytes < 1 || options.links < 1 || options.seconds < 0)
+		problem = "page size and chain links must be positive";
+	
+	if (filename == NULL || problem != NULL) {
+		if (problem != NULL)
+			cerr << "Bad options: " << problem << endl;
+		cerr << "Usage: " << argv[0] << " [-c channels] [-r rate] [-b0 short] [-b1 long] [-m r|l|s|a]"
+			<< " [-e vq_entry_bits] [-D vq_dimensions] [-C classifications] [-t 0|1|2] [-f floor_partitions]"
+			<< " [-x extra_books] [-O] [-z silence_percent] [-a amplitude_bits] [-p page_bytes]"
+			<< " [-l links] [-V] [-s seconds] [-S seed] out.ogg|-" << endl;
+		return 1;
+	}
+	
+	FILE *out = (strcmp(filename, "-") == 0 ? stdout : fopen(filename, "wb"));
+	if (out == NULL) {
+		cerr << "Unable to open " << filename << endl;
+		return 1;
+	}
+	
+	for (int i=0; i<options.links; i++) {
+		gen_options link = options;
+		link.seed = options.seed + i * 7919;
+		if (options.vary_setup && (i & 1))
+			link.extra_books++;
+		VorbisGenerator generator(link);
+		generator.stream(out, (int)(options.seed * 2654435761u) + i);
+	}
+	
+	if (out != stdout)
+		fclose(out);
+	return 0;
+}
@@ -0,0 +1,297 @@
+/***************************************************************************
+ *   Copyright (C) 2008 by Steve Heindel   *
+ *   stevenheindel@gmail.com   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * Golden-output regression test. Decodes every stream listed in a manifest
+ * of "md5  file  [options]" lines (Verification/pcm.md5) and checks the MD5
+ * of its PCM against the reference, reporting the decode speed alongside.
+ * The options are the vorbis tool's decode options, so each output mode can
+ * be hashed too. Every run appends its results to a CSV file, so the speed
+ * can be tracked from one build to the next. Exits nonzero if any stream's
+ * output changed.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <time.h>
+
+#include "oggvorbis.h"
+
+using namespace std;
+
+/**
+ * MD5 (RFC 1321) of everything written to it
+ */
+class MD5PCMSink : public PCMSink {
+	public:
+		/** Hash state */
+		unsigned int state[4];
+		/** Bytes hashed so far */
+		unsigned long long length;
+		/** Partial 64-byte block */
+		unsigned char block[64];
+		/** Seconds of audio decoded, each packet at its own link's rate */
+		double audio_seconds;
+		
+		MD5PCMSink() {
+			state[0] = 0x67452301;
+			state[1] = 0xefcdab89;
+			state[2] = 0x98badcfe;
+			state[3] = 0x10325476;
+			length = 0;
+			audio_seconds = 0;
+		}
+		
+		void packet_decoded(int samples, int rate) {
+			if (rate > 0)
+				audio_seconds += (double)samples / rate;
+		}
+		
+		void write(const char *data, int bytes) {
+			const unsigned char *in = (const unsigned char *)data;
+			int used = (int)(length % 64);
+			length += bytes;
+			
+			if (used > 0) {
+				int n = (bytes < 64 - used ? bytes : 64 - used);
+				memcpy(block + used, in, n);
+				in += n;
+				bytes -= n;
+				if (used + n < 64)
+					return;
+				transform(block);
+			}
+			for (; bytes >= 64; in += 64, bytes -= 64)
+				transform(in);
+			memcpy(block, in, bytes);
+		}
+		
+		/**
+		 * Pads out the message and gives the digest
+		 * @param hex Set to the digest as 32 lowercase hex digits
+		 */
+		void finish(char *hex) {
+			unsigned long long bits = length * 8;
+			unsigned char pad[72];
+			int padding = (int)(56 - length % 64);
+			if (padding <= 0)
+				padding += 64;
+			memset(pad, 0, sizeof(pad));
+			pad[0] = 0x80;
+			for (int i=0; i<8; i++)
+				pad[padding + i] = (unsigned char)(bits >> (i*8));
+			write((const char *)pad, padding + 8);
+			
+			for (int i=0; i<16; i++)
+				sprintf(hex + i*2, "%02x", (state[i/4] >> ((i%4)*8)) & 0xff);
+		}
+	
+	private:
+		static inline unsigned int rotate(unsigned int x, int c) {
+			return (x << c) | (x >> (32 - c));
+		}
+		
+		void transform(const unsigned char *in) {
+			static const unsigned int K[64] = {
+				0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+				0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+				0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+				0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+				0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+				0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+				0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+				0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+			};
+			static const int R[16] = { 7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21 };
+			
+			unsigned int M[16];
+			for (int i=0; i<16; i++)
+				M[i] = in[i*4] | (in[i*4+1] << 8) | (in[i*4+2] << 16) | ((unsigned int)in[i*4+3] << 24);
+			
+			unsigned int a = state[0], b = state[1], c = state[2], d = state[3];
+			for (int i=0; i<64; i++) {
+				unsigned int f;
+				int g;
+				if (i < 16) { f = (b & c) | (~b & d); g = i; }
+				else if (i < 32) { f = (d & b) | (~d & c); g = (5*i + 1) % 16; }
+				else if (i < 48) { f = b ^ c ^ d; g = (3*i + 5) % 16; }
+				else { f = c ^ (b | ~d); g = (7*i) % 16; }
+				
+				unsigned int t = d;
+				d = c;
+				c = b;
+				b = b + rotate(a + f + K[i] + M[g], R[(i/16)*4 + i%4]);
+				a = t;
+			}
+			state[0] += a;
+			state[1] += b;
+			state[2] += c;
+			state[3] += d;
+		}
+};
+
+/** Seconds on a monotonic clock */
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Sets decode options from a manifest line's option words, as the vorbis
+ * tool takes them
+ * @param words The words after the file name
+ * @param options Decode options, already set to the defaults
+ * @return False if a word isn't a decode option
+ */
+static bool parse_options(const vector<string> &words, decode_options &options) {
+	for (size_t i=0; i<words.size(); i++) {
+		const string &w = words[i];
+		bool more = i+1 < words.size();
+		if (w == "-b" && more) // Band limit in Hz
+			options.bandlimit_hz = atoi(words[++i].c_str());
+		else if (w == "-d" && more) // Output rate divisor
+			options.decimation = atoi(words[++i].c_str());
+		else if (w == "-p") // Planar
+			options.planar = true;
+		else if (w == "-s" && more) // Sample size
+			options.bits = atoi(words[++i].c_str());
+		else if (w == "-t") // TPDF dither
+			options.dither = true;
+		else if (w == "-m" && more) // Downmix
+			options.downmix_channels = atoi(words[++i].c_str());
+		else if (w == "-r" && more) // Resample
+			options.resample_rate = atoi(words[++i].c_str());
+		else if (w == "-g" && more && words[i+1] == "track") { // ReplayGain
+			options.replaygain = REPLAYGAIN_TRACK;
+			i++;
+		} else if (w == "-g" && more && words[i+1] == "album") {
+			options.replaygain = REPLAYGAIN_ALBUM;
+			i++;
+		} else if (w == "-a" && more) // ReplayGain preamp in dB
+			options.replaygain_preamp = atof(words[++i].c_str());
+		else
+			return false;
+	}
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *manifest = NULL;
+	const char *results = "vorbistest.csv";
+	for (int i=1; i<argc; i++) {
+		if (strcmp(argv[i], "-o") == 0 && i+1 < argc) // Append results as CSV
+			results = argv[++i];
+		else
+			manifest = argv[i];
+	}
+	
+	if (manifest == NULL) {
+		cerr << "Usage: " << argv[0] << " [-o results.csv] pcm.md5" << endl;
+		return 1;
+	}
+	
+	ifstream list(manifest);
+	if (!list) {
+		cerr << "Unable to open " << manifest << endl;
+		return 1;
+	}
+	
+	// Streams are named relative to the manifest
+	string dir(manifest);
+	size_t slash = dir.find_last_of('/');
+	dir = (slash == string::npos ? string("") : dir.substr(0, slash + 1));
+	
+	// One run's rows share the time it started
+	ofstream csv(results, ios::app);
+	if (!csv)
+		cerr << "Unable to open " << results << "; results not recorded" << endl;
+	long run = (long)time(NULL);
+	
+	int failed = 0;
+	int tested = 0;
+	string line;
+	while (getline(list, line)) {
+		if (line.empty() || line[0] == '#')
+			continue;
+		istringstream fields(line);
+		string expected, name, word;
+		fields >> expected >> name;
+		if (name.empty())
+			continue;
+		vector<string> words;
+		string flags;
+		while (fields >> word) {
+			words.push_back(word);
+			flags += (flags.empty() ? "" : " ") + word;
+		}
+		string label = (flags.empty() ? name : name + " " + flags);
+		string path = dir + name;
+		
+		MD5PCMSink sink;
+		decode_options options;
+		memset(&options, 0, sizeof(options));
+		options.decimation = 1;
+		options.bits = 16;
+		options.sink = &sink;
+		if (!parse_options(words, options)) {
+			cout << "FAIL " << label << ": not decode options" << endl;
+			failed++;
+			tested++;
+			continue;
+		}
+		
+		double started = now();
+		OggVorbis ov((char *)path.c_str(), &options);
+		double seconds = now() - started;
+		double realtime = (seconds > 0 ? sink.audio_seconds / seconds : 0);
+		
+		char md5[33];
+		sink.finish(md5);
+		bool ok = (expected == md5);
+		
+		cout << dec << (ok ? "PASS " : "FAIL ") << label << " " << md5
+			<< fixed << setprecision(3) << " " << seconds << "s "
+			<< setprecision(1) << realtime << "x realtime" << endl;
+		if (!ok) {
+			cout << "     expected " << expected << endl;
+			failed++;
+		}
+		tested++;
+		
+		if (csv)
+			csv << run << "," << name << "," << flags << "," << md5 << "," << (ok ? "pass" : "fail") << ","
+				<< seconds << "," << realtime << endl;
+	}
+	
+	cout << tested - failed << "/" << tested << " streams bit-exact" << endl;
+	return (failed > 0 || tested == 0) ? 1 : 0;
+}
@@ -0,0 +1,75 @@
+#!/bin/sh
+#
+# Profile-guided optimization recipe. Builds a plain Release decoder and an
+# instrumented one, trains the instrumented decoder on the verification
+# corpus and the synthetic mix, rebuilds it from the profile and checks it
+# against the golden output, then benchmarks the two builds side by side.
+#
+# Usage: ./pgo.sh [build_dir [runs]]
+#
+# build_dir defaults to pgo-build; each build is benchmarked runs times
+# (default 5) and its fastest run is reported. CMAKE_ARGS in the
+# environment (e.g. CMAKE_ARGS=-DPORTABLEVORBIS_ARCH=native) is passed to
+# both builds.
+
+set -e
+
+src=$(cd "$(dirname "$0")" && pwd)
+out=${1:-$src/pgo-build}
+runs=${2:-5}
+mkdir -p "$out"
+out=$(cd "$out" && pwd)
+jobs=$(nproc 2>/dev/null || echo 1)
+
+echo "== Plain build"
+cmake -S "$src" -B "$out/plain" -DCMAKE_BUILD_TYPE=Release -DPORTABLEVORBIS_PGO=OFF $CMAKE_ARGS
+cmake --build "$out/plain" -j "$jobs"
+cmake --build "$out/plain" --target synthetic
+
+echo "== Instrumented build and training"
+cmake -S "$src" -B "$out/pgo" -DCMAKE_BUILD_TYPE=Release -DPORTABLEVORBIS_PGO=GENERATE -DPORTABLEVORBIS_PGO_DIR="$out/profile" $CMAKE_ARGS
+cmake --build "$out/pgo" -j "$jobs"
+cmake --build "$out/pgo" --target pgo-train
+
+# The same tree again, so the profiles match its object files
+echo "== Optimized build"
+cmake -S "$src" -B "$out/pgo" -DPORTABLEVORBIS_PGO=USE
+cmake --build "$out/pgo" -j "$jobs"
+ctest --test-dir "$out/pgo" --output-on-failure
+
+echo "== Benchmark"
+streams="$src/Verification/*.ogg $out/plain/Software/X86/synthetic/*.ogg"
+
+# Prints the key=value results of a build's fastest benchmark run
+fastest() {
+	best=
+	best_seconds=
+	i=0
+	while [ $i -lt "$runs" ]; do
+		result=$("$1/Software/X86/vorbis" -B $streams | grep -E '^(seconds|realtime|latency_p50_us|latency_p99_us)=' | tr '\n' ' ')
+		seconds=$(echo "$result" | sed 's/.*seconds=\([0-9.]*\).*/\1/')
+		if [ -z "$best_seconds" ] || awk "BEGIN { exit !($seconds < $best_seconds) }"; then
+			best=$result
+			best_seconds=$seconds
+		fi
+		i=$((i + 1))
+	done
+	echo "$best"
+}
+
+plain=$(fastest "$out/plain")
+pgo=$(fastest "$out/pgo")
+
+echo "$plain|$pgo" | awk -F'|' '
+	function field(s, key,    n, i, kv) {
+		n = split(s, kv, "[ =]")
+		for (i = 1; i < n; i += 2)
+			if (kv[i] == key)
+				return kv[i + 1]
+	}
+	{
+		printf "%-8s %10s %10s %14s %14s\n", "build", "seconds", "realtime", "p50_us", "p99_us"
+		printf "%-8s %10s %10s %14s %14s\n", "plain", field($1, "seconds"), field($1, "realtime"), field($1, "latency_p50_us"), field($1, "latency_p99_us")
+		printf "%-8s %10s %10s %14s %14s\n", "pgo", field($2, "seconds"), field($2, "realtime"), field($2, "latency_p50_us"), field($2, "latency_p99_us")
+		printf "pgo speedup: %.1f%%\n", (field($1, "seconds") / field($2, "seconds") - 1) * 100
+	}'